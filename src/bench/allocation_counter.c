@@ -0,0 +1,63 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "allocation_counter.h"
+#include <stdlib.h>
+
+#if defined __GLIBC__
+
+// Counts heap allocations by replacing malloc() and friends for the whole benchmark executable and forwarding to
+// the glibc implementations. Everything that is allocated, by the relay client, imprint or the C library, is seen.
+
+#if defined __clang__
+#pragma clang diagnostic ignored "-Wreserved-identifier"
+#endif
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static size_t g_relayBenchAllocationCount;
+
+void* malloc(size_t size)
+{
+    g_relayBenchAllocationCount++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    g_relayBenchAllocationCount++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    g_relayBenchAllocationCount++;
+    return __libc_realloc(ptr, size);
+}
+
+bool relayBenchCanCountAllocations(void)
+{
+    return true;
+}
+
+size_t relayBenchAllocationCount(void)
+{
+    return g_relayBenchAllocationCount;
+}
+
+#else
+
+bool relayBenchCanCountAllocations(void)
+{
+    return false;
+}
+
+size_t relayBenchAllocationCount(void)
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,14 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_BENCH_ALLOCATION_COUNTER_H
+#define RELAY_CLIENT_BENCH_ALLOCATION_COUNTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+bool relayBenchCanCountAllocations(void);
+size_t relayBenchAllocationCount(void);
+
+#endif
@@ -0,0 +1,135 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "loopback.h"
+#include <clog/clog.h>
+#include <imprint/allocator.h>
+#include <tiny-libc/tiny_libc.h>
+
+static void relayLoopbackInboxInit(RelayLoopbackInbox* self, struct ImprintAllocator* memory, size_t capacity)
+{
+    self->octets = IMPRINT_ALLOC(memory, capacity * DATAGRAM_TRANSPORT_MAX_SIZE, "loopback inbox");
+    self->octetCounts = IMPRINT_ALLOC_TYPE_COUNT(memory, size_t, capacity);
+    self->capacity = capacity;
+    self->head = 0;
+    self->tail = 0;
+}
+
+/// @param capacity number of datagrams that can be waiting on each side, must be a power of two
+void relayLoopbackInit(RelayLoopback* self, struct ImprintAllocator* memory, size_t capacity)
+{
+    CLOG_ASSERT(capacity != 0 && (capacity & (capacity - 1)) == 0, "loopback capacity must be a power of two")
+
+    for (size_t i = 0; i < 2; ++i) {
+        RelayLoopbackSide* side = &self->sides[i];
+        relayLoopbackInboxInit(&side->inbox, memory, capacity);
+        side->peer = &self->sides[1 - i];
+        tc_mem_clear_type(&side->stats);
+    }
+}
+
+static int relayLoopbackSendOne(RelayLoopbackSide* self, const uint8_t* data, size_t octetCount)
+{
+    if (octetCount > DATAGRAM_TRANSPORT_MAX_SIZE) {
+        return -2;
+    }
+
+    RelayLoopbackInbox* inbox = &self->peer->inbox;
+    if (inbox->tail - inbox->head == inbox->capacity) {
+        // like a full socket receive buffer, the datagram is lost
+        self->stats.droppedDatagramCount++;
+        return 0;
+    }
+
+    size_t index = inbox->tail & (inbox->capacity - 1);
+    tc_memcpy_octets(inbox->octets + index * DATAGRAM_TRANSPORT_MAX_SIZE, data, octetCount);
+    inbox->octetCounts[index] = octetCount;
+    inbox->tail++;
+
+    self->stats.sentDatagramCount++;
+    self->stats.sentOctetCount += octetCount;
+
+    return 0;
+}
+
+static ssize_t relayLoopbackReceiveOne(RelayLoopbackSide* self, uint8_t* data, size_t maxOctetCount)
+{
+    RelayLoopbackInbox* inbox = &self->inbox;
+    if (inbox->tail == inbox->head) {
+        return 0;
+    }
+
+    size_t index = inbox->head & (inbox->capacity - 1);
+    size_t octetCount = inbox->octetCounts[index];
+    if (octetCount > maxOctetCount) {
+        return -2;
+    }
+
+    tc_memcpy_octets(data, inbox->octets + index * DATAGRAM_TRANSPORT_MAX_SIZE, octetCount);
+    inbox->head++;
+
+    return (ssize_t) octetCount;
+}
+
+static int relayLoopbackSend(void* _self, const uint8_t* data, size_t octetCount)
+{
+    return relayLoopbackSendOne((RelayLoopbackSide*) _self, data, octetCount);
+}
+
+static ssize_t relayLoopbackReceive(void* _self, uint8_t* data, size_t maxOctetCount)
+{
+    return relayLoopbackReceiveOne((RelayLoopbackSide*) _self, data, maxOctetCount);
+}
+
+static ssize_t relayLoopbackReceiveMany(void* _self, RelayDatagram* datagrams, size_t maxCount)
+{
+    RelayLoopbackSide* self = (RelayLoopbackSide*) _self;
+
+    size_t count = 0;
+    for (; count < maxCount; ++count) {
+        ssize_t octetCount = relayLoopbackReceiveOne(self, datagrams[count].octets, DATAGRAM_TRANSPORT_MAX_SIZE);
+        if (octetCount <= 0) {
+            break;
+        }
+        datagrams[count].octetCount = (size_t) octetCount;
+    }
+
+    return (ssize_t) count;
+}
+
+static int relayLoopbackSendMany(void* _self, const RelayDatagram* datagrams, size_t count)
+{
+    RelayLoopbackSide* self = (RelayLoopbackSide*) _self;
+
+    for (size_t i = 0; i < count; ++i) {
+        int err = relayLoopbackSendOne(self, datagrams[i].octets, datagrams[i].octetCount);
+        if (err < 0) {
+            return err;
+        }
+    }
+
+    return (int) count;
+}
+
+DatagramTransport relayLoopbackTransport(RelayLoopback* self, size_t sideIndex)
+{
+    DatagramTransport transport;
+    transport.self = &self->sides[sideIndex];
+    transport.send = relayLoopbackSend;
+    transport.receive = relayLoopbackReceive;
+
+    return transport;
+}
+
+/// Batched versions of the loopback transport, to exercise the receiveMany and sendMany paths of the client
+RelayTransportHooks relayLoopbackHooks(RelayLoopback* self, size_t sideIndex)
+{
+    RelayTransportHooks hooks;
+    hooks.self = &self->sides[sideIndex];
+    hooks.receiveMany = relayLoopbackReceiveMany;
+    hooks.sendMany = relayLoopbackSendMany;
+    hooks.pollFd = 0;
+
+    return hooks;
+}
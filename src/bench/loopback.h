@@ -0,0 +1,50 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_BENCH_LOOPBACK_H
+#define RELAY_CLIENT_BENCH_LOOPBACK_H
+
+#include <datagram-transport/transport.h>
+#include <datagram-transport/types.h>
+#include <relay-client/transport_hooks.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ImprintAllocator;
+
+#define RELAY_LOOPBACK_DEFAULT_CAPACITY (1024)
+
+typedef struct RelayLoopbackStats {
+    size_t sentDatagramCount;
+    size_t sentOctetCount;
+    size_t droppedDatagramCount;
+} RelayLoopbackStats;
+
+/// The datagrams waiting to be received on one side of the loopback
+typedef struct RelayLoopbackInbox {
+    uint8_t* octets;
+    size_t* octetCounts;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+} RelayLoopbackInbox;
+
+/// One side of an in-memory datagram link. Datagrams sent on a side are received on its peer.
+typedef struct RelayLoopbackSide {
+    RelayLoopbackInbox inbox;
+    struct RelayLoopbackSide* peer;
+    RelayLoopbackStats stats;
+} RelayLoopbackSide;
+
+/// Two connected in-memory datagram transports, e.g. a client on one side and a relay server stand-in on the
+/// other. Lets the client be driven and measured without sockets. Not thread safe.
+typedef struct RelayLoopback {
+    RelayLoopbackSide sides[2];
+} RelayLoopback;
+
+void relayLoopbackInit(RelayLoopback* self, struct ImprintAllocator* memory, size_t capacity);
+DatagramTransport relayLoopbackTransport(RelayLoopback* self, size_t sideIndex);
+RelayTransportHooks relayLoopbackHooks(RelayLoopback* self, size_t sideIndex);
+
+#endif
@@ -0,0 +1,359 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 200809L
+#include "allocation_counter.h"
+#include "relay_server_stand_in.h"
+#include "send_path.h"
+#include <clog/clog.h>
+#include <clog/console.h>
+#include <imprint/allocator.h>
+#include <imprint/default_setup.h>
+#include <relay-client/client.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <tiny-libc/tiny_libc.h>
+#include <time.h>
+
+#define RELAY_BENCH_MEMORY_OCTET_COUNT (256 * 1024 * 1024)
+#define RELAY_BENCH_LOOPBACK_CAPACITY (1024)
+#define RELAY_BENCH_PACKET_COUNT (320000)
+#define RELAY_BENCH_PAYLOAD_OCTET_COUNT (64)
+#define RELAY_BENCH_FAN_COUNT (32)
+// Packets a connector sends between two updates in the burst scenarios, fits in a listener connection queue
+#define RELAY_BENCH_BURST_COUNT (32)
+#define RELAY_BENCH_HANDSHAKE_PUMP_COUNT (100)
+#define RELAY_BENCH_APPLICATION_ID (0x42)
+#define RELAY_BENCH_CHANNEL_ID (1)
+#define RELAY_BENCH_LISTENER_USER_ID (1)
+
+/// One listening client and a number of connecting clients, all talking to the same relay server stand-in
+typedef struct RelayBenchRig {
+    RelayServerStandIn server;
+    RelayClient* clients; ///< the listening client first, then one client per connector
+    size_t clientCount;
+    RelayListener* listener;
+    RelayConnector** connectors;
+    size_t connectorCount;
+} RelayBenchRig;
+
+typedef struct RelayBenchResult {
+    size_t packetCount;
+    size_t octetCount;
+    uint64_t elapsedNs;
+    uint64_t* latenciesNs;
+    size_t latencyCount;
+    size_t latencyCapacity;
+    size_t allocationCount;
+    size_t transportSendCallCount;
+    size_t datagramCount; ///< received by the stand-in
+} RelayBenchResult;
+
+static uint64_t relayBenchNowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+/// Updates every client so queued datagrams are sent, lets the stand-in route them, and updates every client
+/// again so what was routed ends up in the listener and connector queues
+static void relayBenchPump(RelayBenchRig* rig)
+{
+    MonotonicTimeMs now = monotonicTimeMsNow();
+
+    for (size_t i = 0; i < rig->clientCount; ++i) {
+        relayClientUpdate(&rig->clients[i], now);
+    }
+
+    relayServerStandInUpdate(&rig->server);
+
+    for (size_t i = 0; i < rig->clientCount; ++i) {
+        relayClientUpdate(&rig->clients[i], now);
+    }
+}
+
+static bool relayBenchIsConnected(const RelayBenchRig* rig)
+{
+    if (rig->listener->state != RelayListenerStateConnected) {
+        return false;
+    }
+
+    for (size_t i = 0; i < rig->connectorCount; ++i) {
+        if (rig->connectors[i] == 0 || rig->connectors[i]->state != RelayConnectorStateConnected) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int relayBenchRigInit(RelayBenchRig* rig, struct ImprintAllocator* memory, size_t connectorCount, Clog log)
+{
+    rig->clientCount = connectorCount + 1;
+    rig->connectorCount = connectorCount;
+    relayServerStandInInit(&rig->server, memory, rig->clientCount, connectorCount, RELAY_BENCH_LOOPBACK_CAPACITY,
+                           log);
+    rig->clients = IMPRINT_ALLOC_TYPE_COUNT(memory, RelayClient, rig->clientCount);
+    rig->connectors = IMPRINT_ALLOC_TYPE_COUNT(memory, RelayConnector*, connectorCount);
+
+    for (size_t i = 0; i < rig->clientCount; ++i) {
+        RelaySerializeUserId userId = RELAY_BENCH_LISTENER_USER_ID + i;
+        RelaySerializeUserSessionId userSessionId = 0x10000 + i;
+        int endpointIndex = relayServerStandInAddEndpoint(&rig->server, userId, userSessionId);
+        if (endpointIndex < 0) {
+            return endpointIndex;
+        }
+
+        RelayClientSetup setup;
+        relayClientSetupDefaults(&setup);
+        setup.authenticatedUserSessionId = userSessionId;
+        setup.transportToRelayServer = relayServerStandInClientTransport(&rig->server, (size_t) endpointIndex);
+        setup.memory = memory;
+        setup.log = log;
+        int err = relayClientInitWithSetup(&rig->clients[i], &setup);
+        if (err < 0) {
+            return err;
+        }
+        relayClientSetTransportHooks(&rig->clients[i],
+                                     relayServerStandInClientHooks(&rig->server, (size_t) endpointIndex));
+    }
+
+    rig->listener = relayClientStartListen(&rig->clients[0], RELAY_BENCH_APPLICATION_ID, RELAY_BENCH_CHANNEL_ID);
+    for (size_t i = 0; i < connectorCount; ++i) {
+        rig->connectors[i] = relayClientStartConnect(&rig->clients[i + 1], RELAY_BENCH_LISTENER_USER_ID,
+                                                     RELAY_BENCH_APPLICATION_ID, RELAY_BENCH_CHANNEL_ID);
+    }
+
+    // the listen response and the connect requests need a few round trips through the stand-in
+    for (size_t i = 0; i < RELAY_BENCH_HANDSHAKE_PUMP_COUNT && !relayBenchIsConnected(rig); ++i) {
+        relayBenchPump(rig);
+    }
+
+    if (!relayBenchIsConnected(rig)) {
+        CLOG_C_SOFT_ERROR(&log, "bench clients did not connect through the stand-in")
+        return -2;
+    }
+
+    return 0;
+}
+
+static void relayBenchWritePayload(uint8_t* payload, size_t octetCount)
+{
+    uint64_t sentAt = relayBenchNowNs();
+    tc_memset_octets(payload, 0, octetCount);
+    tc_memcpy_octets(payload, &sentAt, sizeof(sentAt));
+}
+
+static void relayBenchReceived(RelayBenchResult* result, const RelayReceivedPacket* packet, uint64_t now)
+{
+    uint64_t sentAt;
+    tc_memcpy_octets(&sentAt, packet->octets, sizeof(sentAt));
+
+    if (result->latencyCount < result->latencyCapacity) {
+        result->latenciesNs[result->latencyCount++] = now - sentAt;
+    }
+    result->packetCount++;
+    result->octetCount += packet->octetCount;
+}
+
+static void relayBenchReceiveOnListener(RelayBenchRig* rig, RelayBenchResult* result)
+{
+    RelayReceivedPacket packet;
+    uint64_t now = relayBenchNowNs();
+
+    while (relayListenerBorrowPacket(rig->listener, &packet)) {
+        relayBenchReceived(result, &packet, now);
+        relayListenerReleasePacket(rig->listener, &packet);
+    }
+}
+
+static void relayBenchReceiveOnConnectors(RelayBenchRig* rig, RelayBenchResult* result)
+{
+    RelayReceivedPacket packet;
+    uint64_t now = relayBenchNowNs();
+
+    for (size_t i = 0; i < rig->connectorCount; ++i) {
+        while (relayConnectorBorrowPacket(rig->connectors[i], &packet)) {
+            relayBenchReceived(result, &packet, now);
+            relayConnectorReleasePacket(rig->connectors[i], &packet);
+        }
+    }
+}
+
+static int relayBenchCompareLatency(const void* a, const void* b)
+{
+    uint64_t first = *(const uint64_t*) a;
+    uint64_t second = *(const uint64_t*) b;
+
+    return first < second ? -1 : (first > second ? 1 : 0);
+}
+
+static double relayBenchPercentileUs(const RelayBenchResult* result, size_t percent)
+{
+    if (result->latencyCount == 0) {
+        return 0.0;
+    }
+
+    size_t index = (result->latencyCount - 1) * percent / 100;
+    return (double) result->latenciesNs[index] / 1000.0;
+}
+
+static void relayBenchReport(const char* name, RelayBenchResult* result)
+{
+    qsort(result->latenciesNs, result->latencyCount, sizeof(result->latenciesNs[0]), relayBenchCompareLatency);
+
+    double seconds = (double) result->elapsedNs / 1e9;
+    double packetCount = (double) result->packetCount;
+    printf("%-16s %10.0f packets/s %12.0f bytes/s  p50 %8.2f us  p99 %8.2f us  %5.3f sends/packet"
+           "  %5.3f datagrams/packet",
+           name, packetCount / seconds, (double) result->octetCount / seconds, relayBenchPercentileUs(result, 50),
+           relayBenchPercentileUs(result, 99), (double) result->transportSendCallCount / packetCount,
+           (double) result->datagramCount / packetCount);
+
+    if (relayBenchCanCountAllocations()) {
+        printf("  %6.3f allocs/packet\n", (double) result->allocationCount / packetCount);
+    } else {
+        printf("  allocs/packet n/a\n");
+    }
+}
+
+/// Transport send calls made by all clients so far, each one is a system call on a real socket
+static size_t relayBenchTransportSendCalls(const RelayBenchRig* rig)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < rig->clientCount; ++i) {
+        count += rig->clients[i].socket.stats.transportSendCalls;
+    }
+
+    return count;
+}
+
+typedef enum RelayBenchDirection {
+    RelayBenchDirectionToListener, ///< every connector sends to the listener
+    RelayBenchDirectionBroadcast, ///< the listener broadcasts to every connector
+} RelayBenchDirection;
+
+typedef enum RelayBenchSendMode {
+    RelayBenchSendModeImmediate, ///< one transport send for each packet
+    RelayBenchSendModeQueued, ///< packets are queued and sent in one batch by relayClientUpdate()
+    RelayBenchSendModeCoalesced, ///< queued, and packets share datagrams as long as they fit
+} RelayBenchSendMode;
+
+typedef struct RelayBenchScenario {
+    const char* name;
+    size_t connectorCount;
+    RelayBenchDirection direction;
+    size_t packetsPerRound; ///< sent by each sender before the clients are updated
+    RelayBenchSendMode sendMode;
+} RelayBenchScenario;
+
+static int relayBenchRun(const RelayBenchScenario* scenario, struct ImprintAllocator* memory, Clog log)
+{
+    RelayBenchRig rig;
+    int err = relayBenchRigInit(&rig, memory, scenario->connectorCount, log);
+    if (err < 0) {
+        return err;
+    }
+
+    for (size_t i = 0; i < rig.clientCount; ++i) {
+        relayClientSetSendQueueEnabled(&rig.clients[i], scenario->sendMode != RelayBenchSendModeImmediate);
+        relayClientSetCoalescingEnabled(&rig.clients[i], scenario->sendMode == RelayBenchSendModeCoalesced);
+    }
+
+    RelayBenchResult result;
+    tc_mem_clear_type(&result);
+    result.latencyCapacity = RELAY_BENCH_PACKET_COUNT;
+    result.latenciesNs = IMPRINT_ALLOC_TYPE_COUNT(memory, uint64_t, result.latencyCapacity);
+
+    uint8_t payload[RELAY_BENCH_PAYLOAD_OCTET_COUNT];
+    size_t roundCount = RELAY_BENCH_PACKET_COUNT / (scenario->connectorCount * scenario->packetsPerRound);
+
+    size_t allocationCountBefore = relayBenchAllocationCount();
+    size_t transportSendCallsBefore = relayBenchTransportSendCalls(&rig);
+    size_t datagramCountBefore = rig.server.stats.receivedDatagramCount;
+    uint64_t startedAt = relayBenchNowNs();
+
+    for (size_t round = 0; round < roundCount; ++round) {
+        relayBenchWritePayload(payload, sizeof(payload));
+        if (scenario->direction == RelayBenchDirectionToListener) {
+            for (size_t i = 0; i < rig.connectorCount; ++i) {
+                for (size_t j = 0; j < scenario->packetsPerRound; ++j) {
+                    relayConnectorSend(rig.connectors[i], payload, sizeof(payload));
+                }
+            }
+            relayBenchPump(&rig);
+            relayBenchReceiveOnListener(&rig, &result);
+        } else {
+            for (size_t j = 0; j < scenario->packetsPerRound; ++j) {
+                relayListenerBroadcast(rig.listener, RELAY_LISTENER_BROADCAST_ALL, payload, sizeof(payload));
+            }
+            relayBenchPump(&rig);
+            relayBenchReceiveOnConnectors(&rig, &result);
+        }
+    }
+
+    result.elapsedNs = relayBenchNowNs() - startedAt;
+    result.allocationCount = relayBenchAllocationCount() - allocationCountBefore;
+    result.transportSendCallCount = relayBenchTransportSendCalls(&rig) - transportSendCallsBefore;
+    result.datagramCount = rig.server.stats.receivedDatagramCount - datagramCountBefore;
+
+    if (result.packetCount == 0 || rig.server.stats.unknownConnectionCount > 0 ||
+        rig.server.stats.malformedCount > 0) {
+        CLOG_C_SOFT_ERROR(&log, "%s: stand-in could not route %zu packets", scenario->name,
+                          rig.server.stats.unknownConnectionCount + rig.server.stats.malformedCount)
+        return -3;
+    }
+
+    const RelayServerStandInStats* serverStats = &rig.server.stats;
+    if (scenario->sendMode == RelayBenchSendModeCoalesced &&
+        serverStats->receivedMessageCount <= serverStats->receivedDatagramCount) {
+        CLOG_C_SOFT_ERROR(&log, "%s: stand-in got %zu messages in %zu datagrams, nothing was coalesced",
+                          scenario->name, serverStats->receivedMessageCount, serverStats->receivedDatagramCount)
+        return -4;
+    }
+
+    relayBenchReport(scenario->name, &result);
+
+    return 0;
+}
+
+static const RelayBenchScenario g_relayBenchScenarios[] = {
+    {"1->1", 1, RelayBenchDirectionToListener, 1, RelayBenchSendModeImmediate},
+    {"32->1", RELAY_BENCH_FAN_COUNT, RelayBenchDirectionToListener, 1, RelayBenchSendModeImmediate},
+    {"broadcast 1->32", RELAY_BENCH_FAN_COUNT, RelayBenchDirectionBroadcast, 1, RelayBenchSendModeImmediate},
+    // the same burst of packets from one connector, sent one by one or as one batch at the end of the update
+    {"burst immediate", 1, RelayBenchDirectionToListener, RELAY_BENCH_BURST_COUNT, RelayBenchSendModeImmediate},
+    {"burst queued", 1, RelayBenchDirectionToListener, RELAY_BENCH_BURST_COUNT, RelayBenchSendModeQueued},
+    {"burst coalesced", 1, RelayBenchDirectionToListener, RELAY_BENCH_BURST_COUNT, RelayBenchSendModeCoalesced},
+};
+
+int main(void)
+{
+    g_clog.log = clog_console;
+    g_clog.level = CLOG_TYPE_WARN;
+
+    Clog log;
+    log.constantPrefix = "bench";
+    log.config = &g_clog;
+
+    ImprintDefaultSetup memory;
+    imprintDefaultSetupInit(&memory, RELAY_BENCH_MEMORY_OCTET_COUNT);
+    struct ImprintAllocator* allocator = &memory.tagAllocator.info;
+
+    printf("%d octet payloads, %d packets per scenario\n", RELAY_BENCH_PAYLOAD_OCTET_COUNT, RELAY_BENCH_PACKET_COUNT);
+
+    size_t scenarioCount = sizeof(g_relayBenchScenarios) / sizeof(g_relayBenchScenarios[0]);
+    for (size_t i = 0; i < scenarioCount; ++i) {
+        if (relayBenchRun(&g_relayBenchScenarios[i], allocator, log) < 0) {
+            return 1;
+        }
+    }
+
+    if (relayBenchSendPath(allocator, log) < 0) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,303 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include "relay_server_stand_in.h"
+#include <flood/in_stream.h>
+#include <flood/out_stream.h>
+#include <imprint/allocator.h>
+#include <inttypes.h>
+#include <relay-serialize/serialize.h>
+#include <relay-serialize/server_in.h>
+#include <relay-serialize/server_out.h>
+#include <tiny-libc/tiny_libc.h>
+
+/// @param loopbackCapacity datagrams that can be waiting in each direction of an endpoint, must be a power of two
+void relayServerStandInInit(RelayServerStandIn* self, struct ImprintAllocator* memory, size_t endpointCapacity,
+                            size_t connectionCapacity, size_t loopbackCapacity, Clog log)
+{
+    self->memory = memory;
+    self->log = log;
+    self->loopbackCapacity = loopbackCapacity;
+    self->endpoints = IMPRINT_ALLOC_TYPE_COUNT(memory, RelayServerStandInEndpoint, endpointCapacity);
+    self->endpointCapacity = endpointCapacity;
+    self->endpointCount = 0;
+    self->listeners = IMPRINT_ALLOC_TYPE_COUNT(memory, RelayServerStandInListener, endpointCapacity);
+    self->listenerCapacity = endpointCapacity;
+    self->listenerCount = 0;
+    self->connections = IMPRINT_ALLOC_TYPE_COUNT(memory, RelayServerStandInConnection, connectionCapacity);
+    self->connectionCapacity = connectionCapacity;
+    self->connectionCount = 0;
+    tc_mem_clear_type(&self->stats);
+}
+
+/// Adds a client that can then be initialized with relayServerStandInClientTransport()
+/// @return the endpoint index, or negative if there is no room
+int relayServerStandInAddEndpoint(RelayServerStandIn* self, RelaySerializeUserId userId,
+                                  RelaySerializeUserSessionId userSessionId)
+{
+    if (self->endpointCount == self->endpointCapacity) {
+        CLOG_C_SOFT_ERROR(&self->log, "stand-in is out of endpoints")
+        return -1;
+    }
+
+    RelayServerStandInEndpoint* endpoint = &self->endpoints[self->endpointCount];
+    relayLoopbackInit(&endpoint->link, self->memory, self->loopbackCapacity);
+    endpoint->userId = userId;
+    endpoint->userSessionId = userSessionId;
+
+    return (int) self->endpointCount++;
+}
+
+DatagramTransport relayServerStandInClientTransport(RelayServerStandIn* self, size_t endpointIndex)
+{
+    return relayLoopbackTransport(&self->endpoints[endpointIndex].link, 0);
+}
+
+RelayTransportHooks relayServerStandInClientHooks(RelayServerStandIn* self, size_t endpointIndex)
+{
+    return relayLoopbackHooks(&self->endpoints[endpointIndex].link, 0);
+}
+
+static void relayServerStandInSend(RelayServerStandIn* self, size_t endpointIndex, const FldOutStream* outStream)
+{
+    DatagramTransport transport = relayLoopbackTransport(&self->endpoints[endpointIndex].link, 1);
+    datagramTransportSend(&transport, outStream->octets, outStream->pos);
+}
+
+static RelayServerStandInListener* relayServerStandInFindListener(RelayServerStandIn* self,
+                                                                  RelaySerializeUserId userId,
+                                                                  RelaySerializeApplicationId applicationId,
+                                                                  RelaySerializeChannelId channelId)
+{
+    for (size_t i = 0; i < self->listenerCount; ++i) {
+        RelayServerStandInListener* listener = &self->listeners[i];
+        if (self->endpoints[listener->endpointIndex].userId == userId && listener->applicationId == applicationId &&
+            listener->channelId == channelId) {
+            return listener;
+        }
+    }
+
+    return 0;
+}
+
+static int relayServerStandInOnListen(RelayServerStandIn* self, size_t endpointIndex, FldInStream* inStream)
+{
+    RelayServerStandInEndpoint* endpoint = &self->endpoints[endpointIndex];
+    RelaySerializeUserSessionId userSessionId;
+    RelaySerializeListenRequestFromClientToServer request;
+
+    int err = relaySerializeServerInRequestListen(inStream, &userSessionId, &request);
+    if (err < 0) {
+        return err;
+    }
+
+    if (userSessionId != endpoint->userSessionId) {
+        return -2;
+    }
+
+    // a retried request gets the listener it already has
+    RelayServerStandInListener* listener = relayServerStandInFindListener(self, endpoint->userId, request.appId,
+                                                                          request.channelId);
+    if (listener == 0) {
+        if (self->listenerCount == self->listenerCapacity) {
+            CLOG_C_NOTICE(&self->log, "stand-in is out of listeners")
+            return 0;
+        }
+        listener = &self->listeners[self->listenerCount++];
+        listener->endpointIndex = endpointIndex;
+        listener->listenerId = self->listenerCount;
+        listener->applicationId = request.appId;
+        listener->channelId = request.channelId;
+    } else if (listener->endpointIndex != endpointIndex) {
+        CLOG_C_NOTICE(&self->log, "user %" PRIX64 " is already listening on channel %hhu", endpoint->userId,
+                      request.channelId)
+        return 0;
+    }
+
+    RelaySerializeListenResponseFromServerToListener response;
+    response.listenerId = listener->listenerId;
+    response.appId = request.appId;
+    response.channelId = request.channelId;
+    response.requestId = request.requestId;
+
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    FldOutStream outStream;
+    fldOutStreamInit(&outStream, buf, sizeof(buf));
+    relaySerializeServerOutListenResponse(&outStream, &response);
+    relayServerStandInSend(self, endpointIndex, &outStream);
+
+    return 0;
+}
+
+static int relayServerStandInOnConnect(RelayServerStandIn* self, size_t endpointIndex, FldInStream* inStream)
+{
+    RelayServerStandInEndpoint* endpoint = &self->endpoints[endpointIndex];
+    RelaySerializeUserSessionId userSessionId;
+    RelaySerializeConnectRequestFromClientToServer request;
+
+    int err = relaySerializeServerInRequestConnect(inStream, &userSessionId, &request);
+    if (err < 0) {
+        return err;
+    }
+
+    if (userSessionId != endpoint->userSessionId) {
+        return -2;
+    }
+
+    const RelayServerStandInListener* listener = relayServerStandInFindListener(self, request.connectToUserId,
+                                                                                request.appId, request.channelId);
+    if (listener == 0) {
+        // no answer, the connector retries until it gives up
+        CLOG_C_NOTICE(&self->log, "no listener for user %" PRIX64 " on channel %hhu", request.connectToUserId,
+                      request.channelId)
+        return 0;
+    }
+
+    if (self->connectionCount == self->connectionCapacity) {
+        CLOG_C_NOTICE(&self->log, "stand-in is out of connections")
+        return 0;
+    }
+
+    RelayServerStandInConnection* connection = &self->connections[self->connectionCount++];
+    connection->connectorEndpointIndex = endpointIndex;
+    connection->listenerEndpointIndex = listener->endpointIndex;
+    RelaySerializeConnectionId connectionId = self->connectionCount;
+
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    FldOutStream outStream;
+
+    RelaySerializeConnectRequestFromServerToListener requestToListener;
+    requestToListener.listenerId = listener->listenerId;
+    requestToListener.connectionId = connectionId;
+    requestToListener.connectFromUserId = endpoint->userId;
+    requestToListener.requestId = request.requestId;
+    fldOutStreamInit(&outStream, buf, sizeof(buf));
+    relaySerializeServerOutConnectRequestToListener(&outStream, &requestToListener);
+    relayServerStandInSend(self, listener->endpointIndex, &outStream);
+
+    RelaySerializeConnectResponseFromServerToClient response;
+    response.assignedConnectionId = connectionId;
+    response.requestId = request.requestId;
+    fldOutStreamInit(&outStream, buf, sizeof(buf));
+    relaySerializeServerOutConnectResponse(&outStream, &response);
+    relayServerStandInSend(self, endpointIndex, &outStream);
+
+    return 0;
+}
+
+static int relayServerStandInOnPacket(RelayServerStandIn* self, size_t endpointIndex, FldInStream* inStream)
+{
+    RelaySerializeUserSessionId userSessionId;
+    RelaySerializeServerPacketFromClientToServer header;
+
+    int err = relaySerializeServerInPacketToServerHeader(inStream, &userSessionId, &header);
+    if (err < 0) {
+        return err;
+    }
+
+    if (userSessionId != self->endpoints[endpointIndex].userSessionId ||
+        header.packetOctetCount > inStream->size - inStream->pos) {
+        return -2;
+    }
+
+    const uint8_t* payload = inStream->p;
+    inStream->p += header.packetOctetCount;
+    inStream->pos += header.packetOctetCount;
+
+    if (header.connectionId == 0 || header.connectionId > self->connectionCount) {
+        self->stats.unknownConnectionCount++;
+        return 0;
+    }
+
+    const RelayServerStandInConnection* connection = &self->connections[header.connectionId - 1];
+    size_t targetEndpointIndex;
+    if (connection->connectorEndpointIndex == endpointIndex) {
+        targetEndpointIndex = connection->listenerEndpointIndex;
+    } else if (connection->listenerEndpointIndex == endpointIndex) {
+        targetEndpointIndex = connection->connectorEndpointIndex;
+    } else {
+        self->stats.unknownConnectionCount++;
+        return 0;
+    }
+
+    RelaySerializeServerPacketFromServerToClient headerToClient;
+    headerToClient.connectionId = header.connectionId;
+    headerToClient.packetOctetCount = header.packetOctetCount;
+
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    FldOutStream outStream;
+    fldOutStreamInit(&outStream, buf, sizeof(buf));
+    relaySerializeServerOutPacketToClientHeader(&outStream, headerToClient);
+    if (fldOutStreamWriteOctets(&outStream, payload, header.packetOctetCount) < 0) {
+        return -3;
+    }
+    relayServerStandInSend(self, targetEndpointIndex, &outStream);
+
+    self->stats.routedPacketCount++;
+    self->stats.routedOctetCount += header.packetOctetCount;
+
+    return 0;
+}
+
+/// Handles every command in a datagram, a client can coalesce several into one
+static int relayServerStandInFeed(RelayServerStandIn* self, size_t endpointIndex, const uint8_t* data,
+                                  size_t octetCount)
+{
+    FldInStream inStream;
+    fldInStreamInit(&inStream, data, octetCount);
+
+    while (inStream.pos < inStream.size) {
+        uint8_t cmd;
+        fldInStreamReadUInt8(&inStream, &cmd);
+        self->stats.receivedMessageCount++;
+
+        int err;
+        switch (cmd) {
+            case relaySerializeCmdListenRequestToServer:
+                err = relayServerStandInOnListen(self, endpointIndex, &inStream);
+                break;
+            case relaySerializeCmdConnectRequestToServer:
+                err = relayServerStandInOnConnect(self, endpointIndex, &inStream);
+                break;
+            case relaySerializeCmdPacket:
+                err = relayServerStandInOnPacket(self, endpointIndex, &inStream);
+                break;
+            default:
+                CLOG_C_NOTICE(&self->log, "stand-in got unknown command %02X", cmd)
+                err = -1;
+                break;
+        }
+
+        if (err < 0) {
+            // the rest of the datagram can not be trusted
+            self->stats.malformedCount++;
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+/// Receives everything the clients have sent and answers or routes it to the other clients
+/// @return the number of datagrams handled
+size_t relayServerStandInUpdate(RelayServerStandIn* self)
+{
+    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    size_t handledCount = 0;
+
+    for (size_t i = 0; i < self->endpointCount; ++i) {
+        DatagramTransport transport = relayLoopbackTransport(&self->endpoints[i].link, 1);
+        while (true) {
+            ssize_t octetCount = datagramTransportReceive(&transport, buf, sizeof(buf));
+            if (octetCount <= 0) {
+                break;
+            }
+            self->stats.receivedDatagramCount++;
+            relayServerStandInFeed(self, i, buf, (size_t) octetCount);
+            handledCount++;
+        }
+    }
+
+    return handledCount;
+}
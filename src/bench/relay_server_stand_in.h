@@ -0,0 +1,74 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_BENCH_RELAY_SERVER_STAND_IN_H
+#define RELAY_CLIENT_BENCH_RELAY_SERVER_STAND_IN_H
+
+#include "loopback.h"
+#include <clog/clog.h>
+#include <relay-client/transport_hooks.h>
+#include <relay-serialize/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ImprintAllocator;
+
+/// A relay client as seen by the stand-in, connected to it through a loopback
+typedef struct RelayServerStandInEndpoint {
+    RelayLoopback link; ///< side 0 is the client, side 1 the stand-in
+    RelaySerializeUserId userId;
+    RelaySerializeUserSessionId userSessionId;
+} RelayServerStandInEndpoint;
+
+typedef struct RelayServerStandInListener {
+    size_t endpointIndex;
+    RelaySerializeListenerId listenerId;
+    RelaySerializeApplicationId applicationId;
+    RelaySerializeChannelId channelId;
+} RelayServerStandInListener;
+
+/// A connector and the listener it was connected to. The connection id is the index plus one.
+typedef struct RelayServerStandInConnection {
+    size_t connectorEndpointIndex;
+    size_t listenerEndpointIndex;
+} RelayServerStandInConnection;
+
+typedef struct RelayServerStandInStats {
+    size_t receivedDatagramCount;
+    size_t receivedMessageCount; ///< more than the datagrams when the client coalesces
+    size_t routedPacketCount;
+    size_t routedOctetCount;
+    size_t unknownConnectionCount;
+    size_t malformedCount;
+} RelayServerStandInStats;
+
+/// Does what the relay server does for the commands a relay client sends, so the client can be driven and
+/// measured in a single process: answers listen and connect requests and routes packets between connectors and
+/// listeners. There is no authentication, the user session id in a request must only match the endpoint.
+typedef struct RelayServerStandIn {
+    RelayServerStandInEndpoint* endpoints;
+    size_t endpointCount;
+    size_t endpointCapacity;
+    RelayServerStandInListener* listeners;
+    size_t listenerCount;
+    size_t listenerCapacity;
+    RelayServerStandInConnection* connections;
+    size_t connectionCount;
+    size_t connectionCapacity;
+    struct ImprintAllocator* memory;
+    size_t loopbackCapacity;
+    RelayServerStandInStats stats;
+    Clog log;
+} RelayServerStandIn;
+
+void relayServerStandInInit(RelayServerStandIn* self, struct ImprintAllocator* memory, size_t endpointCapacity,
+                            size_t connectionCapacity, size_t loopbackCapacity, Clog log);
+int relayServerStandInAddEndpoint(RelayServerStandIn* self, RelaySerializeUserId userId,
+                                  RelaySerializeUserSessionId userSessionId);
+DatagramTransport relayServerStandInClientTransport(RelayServerStandIn* self, size_t endpointIndex);
+RelayTransportHooks relayServerStandInClientHooks(RelayServerStandIn* self, size_t endpointIndex);
+size_t relayServerStandInUpdate(RelayServerStandIn* self);
+
+#endif
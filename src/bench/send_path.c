@@ -0,0 +1,141 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 200809L
+#include "send_path.h"
+#include <relay-client/socket.h>
+#include <stdio.h>
+#include <tiny-libc/tiny_libc.h>
+#include <time.h>
+#if defined __x86_64__ || defined __i386__
+#include <x86intrin.h>
+#define RELAY_BENCH_HAS_CYCLE_COUNTER
+#endif
+
+#define RELAY_BENCH_SEND_COUNT (2000000)
+#define RELAY_BENCH_SEND_PAYLOAD_OCTET_COUNT (64)
+#define RELAY_BENCH_SEND_USER_SESSION_ID (0x1234)
+#define RELAY_BENCH_SEND_CONNECTION_ID (0x5678)
+
+/// Keeps the last datagram instead of sending it, so only the client side of a send is measured
+typedef struct RelayBenchSink {
+    uint8_t octets[DATAGRAM_TRANSPORT_MAX_SIZE];
+    size_t octetCount;
+} RelayBenchSink;
+
+typedef enum RelayBenchSendVariant {
+    RelayBenchSendSerializeHeader,
+    RelayBenchSendCachedHeader,
+    RelayBenchSendUncachedHeader,
+} RelayBenchSendVariant;
+
+static int relayBenchSinkSend(void* _self, const uint8_t* data, size_t octetCount)
+{
+    RelayBenchSink* self = (RelayBenchSink*) _self;
+    tc_memcpy_octets(self->octets, data, octetCount);
+    self->octetCount = octetCount;
+    return 0;
+}
+
+static uint64_t relayBenchSendNowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+static uint64_t relayBenchCycles(void)
+{
+#if defined RELAY_BENCH_HAS_CYCLE_COUNTER
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int relayBenchSendOnce(RelaySocket* socket, RelayBenchSendVariant variant, const RelayPacketHeader* header,
+                              const uint8_t* payload)
+{
+    if (variant == RelayBenchSendSerializeHeader) {
+        return relaySocketSendPacket(socket, RELAY_BENCH_SEND_USER_SESSION_ID, RELAY_BENCH_SEND_CONNECTION_ID,
+                                     payload, RELAY_BENCH_SEND_PAYLOAD_OCTET_COUNT);
+    }
+
+    return relaySocketSendPacketWithHeader(socket, header, payload, RELAY_BENCH_SEND_PAYLOAD_OCTET_COUNT);
+}
+
+static int relayBenchSendVariant(const char* name, RelayBenchSendVariant variant, RelaySocket* socket,
+                                 const RelayPacketHeader* header)
+{
+    uint8_t payload[RELAY_BENCH_SEND_PAYLOAD_OCTET_COUNT];
+    tc_memset_octets(payload, 0x5a, sizeof(payload));
+
+    uint64_t startNs = relayBenchSendNowNs();
+    uint64_t startCycles = relayBenchCycles();
+
+    for (size_t i = 0; i < RELAY_BENCH_SEND_COUNT; ++i) {
+        payload[0] = (uint8_t) i;
+        if (relayBenchSendOnce(socket, variant, header, payload) < 0) {
+            fprintf(stderr, "%s: send failed\n", name);
+            return -1;
+        }
+    }
+
+    uint64_t cycles = relayBenchCycles() - startCycles;
+    uint64_t elapsedNs = relayBenchSendNowNs() - startNs;
+
+#if defined RELAY_BENCH_HAS_CYCLE_COUNTER
+    printf("%-18s %8.1f ns/send %8.1f cycles/send\n", name, (double) elapsedNs / RELAY_BENCH_SEND_COUNT,
+           (double) cycles / RELAY_BENCH_SEND_COUNT);
+#else
+    (void) cycles;
+    printf("%-18s %8.1f ns/send\n", name, (double) elapsedNs / RELAY_BENCH_SEND_COUNT);
+#endif
+
+    return 0;
+}
+
+/// Measures a single packet send in immediate mode: serializing the relay header for each packet, copying the cached
+/// header, and serializing it from the header when the octet count offset is unknown
+int relayBenchSendPath(struct ImprintAllocator* memory, Clog log)
+{
+    static RelayBenchSink sink;
+    static RelaySocket socket;
+
+    DatagramTransport transport;
+    transport.self = &sink;
+    transport.send = relayBenchSinkSend;
+    transport.receive = 0;
+    relaySocketInit(&socket, transport, memory, log);
+
+    RelayPacketHeader cachedHeader;
+    if (relayPacketHeaderInit(&cachedHeader, RELAY_BENCH_SEND_USER_SESSION_ID, RELAY_BENCH_SEND_CONNECTION_ID) < 0) {
+        fprintf(stderr, "could not cache the relay header\n");
+        return -1;
+    }
+
+    RelayPacketHeader uncachedHeader = cachedHeader;
+    uncachedHeader.octetCountOffset = RELAY_PACKET_HEADER_NO_OCTET_COUNT_OFFSET;
+
+    printf("\nsend path, %d octet payloads, %d sends\n", RELAY_BENCH_SEND_PAYLOAD_OCTET_COUNT, RELAY_BENCH_SEND_COUNT);
+
+    if (relayBenchSendVariant("serialize header", RelayBenchSendSerializeHeader, &socket, 0) < 0 ||
+        relayBenchSendVariant("cached header", RelayBenchSendCachedHeader, &socket, &cachedHeader) < 0) {
+        return -1;
+    }
+
+    RelayBenchSink cachedSink = sink;
+
+    if (relayBenchSendVariant("uncached header", RelayBenchSendUncachedHeader, &socket, &uncachedHeader) < 0) {
+        return -1;
+    }
+
+    if (sink.octetCount != cachedSink.octetCount ||
+        tc_memcmp(sink.octets, cachedSink.octets, sink.octetCount) != 0) {
+        fprintf(stderr, "uncached header does not serialize the same datagram\n");
+        return -1;
+    }
+
+    return 0;
+}
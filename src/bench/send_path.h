@@ -0,0 +1,14 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_BENCH_SEND_PATH_H
+#define RELAY_CLIENT_BENCH_SEND_PATH_H
+
+#include <clog/clog.h>
+
+struct ImprintAllocator;
+
+int relayBenchSendPath(struct ImprintAllocator* memory, Clog log);
+
+#endif
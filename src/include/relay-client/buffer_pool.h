@@ -0,0 +1,29 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_BUFFER_POOL_H
+#define RELAY_CLIENT_BUFFER_POOL_H
+
+#include <stddef.h>
+
+struct ImprintAllocator;
+
+typedef struct RelayBufferPoolBlock {
+    struct RelayBufferPoolBlock* next;
+} RelayBufferPoolBlock;
+
+/// Blocks of the same size that are allocated on first use and recycled when returned.
+/// ImprintAllocator has no free, so returned blocks are kept on a free list.
+typedef struct RelayBufferPool {
+    RelayBufferPoolBlock* freeBlocks;
+    size_t blockOctetCount;
+    size_t allocatedBlockCount;
+    struct ImprintAllocator* memory;
+} RelayBufferPool;
+
+void relayBufferPoolInit(RelayBufferPool* self, struct ImprintAllocator* memory, size_t blockOctetCount);
+void* relayBufferPoolAlloc(RelayBufferPool* self);
+void relayBufferPoolFree(RelayBufferPool* self, void* block);
+
+#endif
@@ -6,20 +6,105 @@
 #define RELAY_CLIENT_CLIENT_H
 
 #include "connector.h"
+#include <relay-client/early_arrival.h>
 #include <relay-client/listener.h>
+#include <relay-client/microsecond_clock.h>
+#include <relay-client/packet_pool.h>
+#include <relay-client/pending_request.h>
+#include <relay-client/route.h>
+#include <relay-client/transport_hooks.h>
+#if defined RELAY_CLIENT_THREADED
+#include <relay-client/io_thread.h>
+#endif
 
+// Default capacities, see RelayClientSetup
 #define RELAY_CLIENT_LISTENER_CAPACITY (4)
 #define RELAY_CLIENT_CONNECTION_CAPACITY (8)
+#define RELAY_CLIENT_RECEIVE_BATCH_COUNT (32)
+#define RELAY_CLIENT_DEFAULT_RECEIVE_MAX_DATAGRAM_COUNT (1024)
+// Idle listener connections are kept, set RelayClientSetup.connectionIdleTimeoutMs to have them removed
+#define RELAY_CLIENT_DEFAULT_CONNECTION_IDLE_TIMEOUT_MS (0)
+// Returned by relayClientNextDeadline() when there are no timers pending
+#define RELAY_CLIENT_NO_DEADLINE (INT64_MAX)
+#define RELAY_CLIENT_EARLY_ARRIVAL_REPLAY_BATCH_COUNT (16)
+// Half of the default packet pool, see RelayClientSetup.endpointPacketQuota
+#define RELAY_CLIENT_DEFAULT_ENDPOINT_PACKET_QUOTA (RELAY_PACKET_POOL_DEFAULT_SLOT_COUNT / 2)
 
-typedef struct RelayClient {
-    RelayListener listeners[RELAY_CLIENT_LISTENER_CAPACITY];
-    RelayConnector connectors[RELAY_CLIENT_CONNECTION_CAPACITY];
+typedef struct RelayClientReceiveBudget {
+    size_t maxDatagramCount;
+    MonotonicTimeMs maxDurationMs;
+} RelayClientReceiveBudget;
+
+typedef struct RelayClientStats {
+    size_t datagramsReceived;
+    size_t octetsReceived;
+    size_t deserializeErrorCount;
+    size_t unknownConnectionDropCount;
+    size_t poolExhaustedDropCount;
+    size_t endpointQuotaDropCount;
+    size_t updateCount;
+    RelayMicroseconds lastUpdateDurationUs;
+    RelayMicroseconds maxUpdateDurationUs;
+    RelayMicroseconds totalUpdateDurationUs;
+} RelayClientStats;
+
+typedef struct RelayClientSetup {
+    RelaySerializeUserSessionId authenticatedUserSessionId;
     DatagramTransport transportToRelayServer;
+    struct ImprintAllocator* memory;
+    size_t listenerCapacity;
+    size_t connectorCapacity;
+    size_t maxConnectionsPerListener;
+    size_t listenerConnectionQueueCapacity;
+    size_t packetPoolSlotCount;
+    RelayRetrySetup handshakeRetry;
+    /// listener connections that have not received anything for this long are removed, without notifying the
+    /// application. Zero, the default, keeps connections until the listener is stopped.
+    MonotonicTimeMs connectionIdleTimeoutMs;
+    /// received packets that can be queued on one listener or connector, zero only limits them by queue capacity
+    size_t endpointPacketQuota;
+    /// packets for connection ids that are not known yet are held this long, zero capacity drops them
+    size_t earlyArrivalCapacity;
+    MonotonicTimeMs earlyArrivalHoldTimeMs;
+    Clog log;
+} RelayClientSetup;
+
+typedef struct RelayClient {
+    RelayListener* listeners;
+    size_t listenerCapacity;
+    RelayConnector* connectors;
+    size_t connectorCapacity;
+    RelayRoutes routes;
+    RelayEarlyArrivals earlyArrivals;
+    RelayPendingRequests pendingRequests;
+    RelaySocket socket;
+    RelayClientReceiveBudget receiveBudget;
+    RelayRetrySetup handshakeRetry;
+    MonotonicTimeMs connectionIdleTimeoutMs;
+    size_t endpointPacketQuota;
+    MonotonicTimeMs now;
+    MonotonicTimeMs nextIdleCheckAt;
+    RelayClientStats stats;
     RelaySerializeUserSessionId userSessionId;
     Clog log;
+    RelayPacketPool packetPool;
+    RelayBufferPool listenerBufferPool;
+    RelayBufferPool connectorBufferPool;
+    RelayDatagram receiveDatagrams[RELAY_CLIENT_RECEIVE_BATCH_COUNT];
+    RelayPacketSlotIndex receiveSlots[RELAY_CLIENT_RECEIVE_BATCH_COUNT];
     uint8_t receiveBuf[DATAGRAM_TRANSPORT_MAX_SIZE];
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    MonotonicTimeMs datagramReceivedAt; ///< when the datagram that is being fed was received from the transport
+#endif
+#if defined RELAY_CLIENT_THREADED
+    RelayIoThread ioThread;
+    bool useIoThread;
+    size_t ioThreadLentSlotCount;
+#endif
 } RelayClient;
 
+void relayClientSetupDefaults(RelayClientSetup* setup);
+int relayClientInitWithSetup(RelayClient* self, const RelayClientSetup* setup);
 int relayClientInit(RelayClient* self, RelaySerializeUserSessionId authenticatedUserSessionId,
                     DatagramTransport transportToRelayServer, struct ImprintAllocator* memory, const char* prefix,
                     Clog log);
@@ -27,6 +112,19 @@ RelayListener* relayClientStartListen(RelayClient* self, RelaySerializeApplicati
                                       RelaySerializeChannelId channelId);
 RelayConnector* relayClientStartConnect(RelayClient* self, RelaySerializeUserId userId,
                                         RelaySerializeApplicationId applicationId, RelaySerializeChannelId channelId);
+void relayClientStopListen(RelayClient* self, RelayListener* listener);
+void relayClientStopConnect(RelayClient* self, RelayConnector* connector);
 int relayClientUpdate(RelayClient* self, MonotonicTimeMs now);
+void relayClientSetTransportHooks(RelayClient* self, RelayTransportHooks hooks);
+void relayClientSetReceiveBudget(RelayClient* self, size_t maxDatagramCount, MonotonicTimeMs maxDurationMs);
+void relayClientSetSendQueueEnabled(RelayClient* self, bool enabled);
+void relayClientSetCoalescingEnabled(RelayClient* self, bool enabled);
+int relayClientFlush(RelayClient* self);
+int relayClientPollFd(const RelayClient* self);
+MonotonicTimeMs relayClientNextDeadline(const RelayClient* self);
+#if defined RELAY_CLIENT_THREADED
+int relayClientStartIoThread(RelayClient* self, size_t slotCount);
+void relayClientStopIoThread(RelayClient* self);
+#endif
 
 #endif
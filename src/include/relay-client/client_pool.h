@@ -0,0 +1,145 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_CLIENT_POOL_H
+#define RELAY_CLIENT_CLIENT_POOL_H
+
+#include <clog/clog.h>
+#include <pthread.h>
+#include <relay-client/client.h>
+#include <relay-client/spsc_ring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ImprintAllocator;
+
+#define RELAY_CLIENT_POOL_DEFAULT_MAILBOX_CAPACITY (64)
+#define RELAY_CLIENT_POOL_DEFAULT_UPDATE_INTERVAL_MS (2)
+#define RELAY_CLIENT_POOL_EPOLL_EVENT_COUNT (64)
+// Start and stop commands that can be waiting for a client, must be a power of two
+#define RELAY_CLIENT_POOL_COMMAND_CAPACITY (16)
+// Endpoint index reported when a start command could not get a listener or connector
+#define RELAY_CLIENT_POOL_NO_ENDPOINT (UINT16_MAX)
+
+typedef enum RelayClientPoolEndpointKind {
+    RelayClientPoolEndpointListener,
+    RelayClientPoolEndpointConnector,
+} RelayClientPoolEndpointKind;
+
+typedef enum RelayClientPoolPacketKind {
+    RelayClientPoolPacketData,
+    RelayClientPoolPacketHandshakeDone, ///< a started listener or connector has a handshake result, no octets
+} RelayClientPoolPacketKind;
+
+/// A packet on its way between a match thread and the worker that owns the client
+typedef struct RelayClientPoolPacket {
+    uint8_t kind;
+    uint8_t endpointKind;
+    uint16_t endpointIndex; ///< listener or connector index in the client
+    uint16_t connectionIndex; ///< only used for listeners
+    uint8_t handshakeResult; ///< RelayHandshakeResult, only used for RelayClientPoolPacketHandshakeDone
+    uint32_t tag; ///< from the start command, only used for RelayClientPoolPacketHandshakeDone
+    uint16_t octetCount;
+    uint8_t octets[DATAGRAM_TRANSPORT_MAX_SIZE];
+} RelayClientPoolPacket;
+
+typedef enum RelayClientPoolCommandKind {
+    RelayClientPoolCommandStartListen,
+    RelayClientPoolCommandStartConnect,
+    RelayClientPoolCommandStopListen,
+    RelayClientPoolCommandStopConnect,
+} RelayClientPoolCommandKind;
+
+/// Asks the worker to start or stop a listener or connector on a running client
+typedef struct RelayClientPoolCommand {
+    uint8_t kind;
+    uint16_t endpointIndex; ///< only used when stopping
+    uint32_t tag;
+    RelaySerializeUserId userId; ///< only used for connect
+    RelaySerializeApplicationId applicationId;
+    RelaySerializeChannelId channelId;
+} RelayClientPoolCommand;
+
+struct RelayClientPoolEntry;
+
+/// Handshake completion user data for a listener or connector started by a command
+typedef struct RelayClientPoolEndpointContext {
+    struct RelayClientPoolEntry* entry;
+    uint8_t endpointKind;
+    uint16_t endpointIndex;
+    uint32_t tag;
+} RelayClientPoolEndpointContext;
+
+/// A client and its mailboxes. Each mailbox has one producer and one consumer thread.
+typedef struct RelayClientPoolEntry {
+    RelayClient client;
+    RelaySpscRing toClient;
+    RelaySpscRing fromClient;
+    RelaySpscRing commands;
+    RelayClientPoolEndpointContext* listenerContexts;
+    RelayClientPoolEndpointContext* connectorContexts;
+    MonotonicTimeMs nextDeadline; ///< when the worker must update the client even without datagrams or mail
+    bool isPolled; ///< the worker waits on the socket of the client
+    size_t droppedToClientCount; ///< written by the match thread
+    size_t droppedFromClientCount; ///< written by the worker
+    size_t skippedToClientCount; ///< written by the worker, for endpoints or connections that are not active
+} RelayClientPoolEntry;
+
+typedef struct RelayClientPoolWorker {
+    struct RelayClientPool* pool;
+    size_t firstClientIndex;
+    size_t clientCount;
+    int epollFd;
+    int cpuIndex;
+    pthread_t thread;
+} RelayClientPoolWorker;
+
+typedef struct RelayClientPoolSetup {
+    size_t clientCount;
+    size_t workerCount;
+    /// worker i is pinned to core firstCpuIndex + i, negative disables pinning
+    int firstCpuIndex;
+    /// how often the mailboxes are checked, and clients without a pollable socket are updated
+    MonotonicTimeMs updateIntervalMs;
+    size_t mailboxCapacity;
+    struct ImprintAllocator* memory;
+    Clog log;
+} RelayClientPoolSetup;
+
+/// Shards clients over worker threads. Each worker waits on the sockets of its clients with epoll, and only
+/// runs relayClientUpdate() for a client that has received datagrams, has mail or has reached its
+/// relayClientNextDeadline(). Match threads exchange packets with their client through the mailboxes, and start
+/// and stop listeners and connectors with commands. Handshake completions run on the worker, inside
+/// relayClientUpdate(), so the pool sets its own and hands the results back as RelayClientPoolPacketHandshakeDone
+/// packets. A completion set directly on a pooled listener or connector would run on the worker thread.
+typedef struct RelayClientPool {
+    RelayClientPoolEntry* entries;
+    size_t clientCount;
+    RelayClientPoolWorker* workers;
+    size_t workerCount;
+    MonotonicTimeMs updateIntervalMs;
+    struct ImprintAllocator* memory;
+    int isRunning;
+    Clog log;
+} RelayClientPool;
+
+void relayClientPoolSetupDefaults(RelayClientPoolSetup* setup);
+int relayClientPoolInit(RelayClientPool* self, const RelayClientPoolSetup* setup);
+RelayClient* relayClientPoolClient(RelayClientPool* self, size_t clientIndex);
+int relayClientPoolStart(RelayClientPool* self);
+void relayClientPoolStop(RelayClientPool* self);
+int relayClientPoolSend(RelayClientPool* self, size_t clientIndex, RelayClientPoolEndpointKind endpointKind,
+                        size_t endpointIndex, size_t connectionIndex, const uint8_t* data, size_t octetCount);
+int relayClientPoolStartListen(RelayClientPool* self, size_t clientIndex, RelaySerializeApplicationId applicationId,
+                               RelaySerializeChannelId channelId, uint32_t tag);
+int relayClientPoolStartConnect(RelayClientPool* self, size_t clientIndex, RelaySerializeUserId userId,
+                                RelaySerializeApplicationId applicationId, RelaySerializeChannelId channelId,
+                                uint32_t tag);
+int relayClientPoolStopListen(RelayClientPool* self, size_t clientIndex, size_t endpointIndex);
+int relayClientPoolStopConnect(RelayClientPool* self, size_t clientIndex, size_t endpointIndex);
+const RelayClientPoolPacket* relayClientPoolBorrowPacket(RelayClientPool* self, size_t clientIndex);
+void relayClientPoolReleasePacket(RelayClientPool* self, size_t clientIndex);
+
+#endif
@@ -11,6 +11,11 @@
 #include <datagram-transport/types.h>
 #include <discoid/circular_buffer.h>
 #include <monotonic-time/monotonic_time.h>
+#include <relay-client/buffer_pool.h>
+#include <relay-client/handshake.h>
+#include <relay-client/packet_queue.h>
+#include <relay-client/retry.h>
+#include <relay-client/stats.h>
 #include <relay-client/socket.h>
 #include <relay-serialize/client_out.h>
 #include <stdbool.h>
@@ -29,34 +34,65 @@ typedef enum RelayConnectorState {
 
 struct ImprintAllocator;
 
+#define RELAY_CONNECTOR_IN_QUEUE_CAPACITY (128)
+// Packets that are sent while connecting are kept until the connection id is known, must be a power of two
+#define RELAY_CONNECTOR_PRE_CONNECT_QUEUE_CAPACITY (16)
+
 typedef struct RelayConnector {
     RelayConnectorState state;
     Clog log;
     RelaySerializeConnectionId connectionId;
+    RelayPacketHeader header;
     RelaySerializeUserSessionId userSessionId;
 
     RelaySerializeUserId connectToUserId;
     RelaySerializeApplicationId applicationId;
     RelaySerializeChannelId channelId;
 
-    DatagramTransport transportToRelayServer;
+    RelaySocket* socket;
     DatagramTransport connectorTransport;
-    DiscoidBuffer inBuffer;
-    RelaySerializeRequestId requestId;
+    RelayPacketPool* pool;
+    RelayBufferPool* bufferPool;
+    RelayPacketQueue inQueue;
+    RelayPacketQueue preConnectQueue;
+    RelayPacketSlotIndex reservedPreConnectSlot;
+    RelayPacketOverflowPolicy overflowPolicy;
+    RelayPacketDropStats dropStats;
+    RelayPacketDropStats preConnectDropStats;
+    RelayTrafficStats traffic;
+    size_t inQueueHighWater;
+    size_t handshakeRetryCount;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    RelayLatencyHistogram residency; ///< from being queued until it is borrowed by the application
+    RelayLatencyHistogram dispatchLatency; ///< from being received from the transport until it is borrowed
+#endif
+    RelaySerializeRequestId requestId; ///< the same for every attempt of a handshake
 
-    size_t waitTime;
-    uint8_t tempBuffer[DATAGRAM_TRANSPORT_MAX_SIZE];
+    RelayRetry retry;
+    int lastError;
+    RelayHandshakeCompletion completion;
 } RelayConnector;
 
-int relayConnectorInit(RelayConnector* self, struct ImprintAllocator* memory, Clog log);
+int relayConnectorInit(RelayConnector* self, RelayPacketPool* pool, RelayBufferPool* bufferPool, Clog log);
+size_t relayConnectorBufferOctetCount(void);
+int relayConnectorFlushPreConnectQueue(RelayConnector* self);
 void relayConnectorReset(RelayConnector* self);
-void relayConnectorReInit(RelayConnector* self, DatagramTransport* transportToRelayServer,
+void relayConnectorReInit(RelayConnector* self, RelaySocket* socket,
                           RelaySerializeUserSessionId userSessionId, RelaySerializeUserId userId,
-                          RelaySerializeApplicationId applicationId, RelaySerializeChannelId channelId);
+                          RelaySerializeApplicationId applicationId, RelaySerializeChannelId channelId,
+                          RelaySerializeRequestId requestId, const RelayRetrySetup* retrySetup);
 void relayConnectorDestroy(RelayConnector* self);
 void relayConnectorDisconnect(RelayConnector* self);
+void relayConnectorSetCompletion(RelayConnector* self, RelayHandshakeCompletion completion);
+void relayConnectorAbortHandshake(RelayConnector* self, int error, RelayHandshakeResult result);
 int relayConnectorUpdate(RelayConnector* self, MonotonicTimeMs now);
 int relayConnectorPushPacket(RelayConnector* self, const uint8_t* data, size_t octetCountInPacket);
+int relayConnectorPushPacketRef(RelayConnector* self, const RelayPacketRef* ref);
+int relayConnectorBorrowPacket(RelayConnector* self, RelayReceivedPacket* outPacket);
+void relayConnectorReleasePacket(RelayConnector* self, const RelayReceivedPacket* packet);
 ssize_t relayConnectorSend(RelayConnector* self, const uint8_t* data, size_t octetCount);
+uint8_t* relayConnectorReserve(RelayConnector* self, size_t* outMaxOctetCount);
+int relayConnectorCommit(RelayConnector* self, size_t octetCount);
+void relayConnectorSetOverflowPolicy(RelayConnector* self, RelayPacketOverflowPolicy policy);
 
 #endif
@@ -0,0 +1,49 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_EARLY_ARRIVAL_H
+#define RELAY_CLIENT_EARLY_ARRIVAL_H
+
+#include <monotonic-time/monotonic_time.h>
+#include <relay-client/packet_queue.h>
+#include <relay-serialize/types.h>
+#include <stddef.h>
+
+struct ImprintAllocator;
+
+#define RELAY_EARLY_ARRIVAL_DEFAULT_CAPACITY (32)
+#define RELAY_EARLY_ARRIVAL_DEFAULT_HOLD_TIME_MS (500)
+
+typedef struct RelayEarlyArrival {
+    RelaySerializeConnectionId connectionId;
+    RelayPacketRef ref;
+    MonotonicTimeMs expiresAt;
+} RelayEarlyArrival;
+
+typedef struct RelayEarlyArrivalStats {
+    size_t heldCount;
+    size_t replayedCount;
+    size_t expiredCount;
+    size_t evictedCount;
+} RelayEarlyArrivalStats;
+
+/// Packets that arrived for a connection id before the connection request or connect response that
+/// establishes it. Entries are kept in arrival order, so the oldest are evicted first when it is full.
+typedef struct RelayEarlyArrivals {
+    RelayEarlyArrival* entries;
+    size_t capacity;
+    size_t count;
+    MonotonicTimeMs holdTimeMs;
+    RelayEarlyArrivalStats stats;
+} RelayEarlyArrivals;
+
+void relayEarlyArrivalsInit(RelayEarlyArrivals* self, struct ImprintAllocator* memory, size_t capacity,
+                            MonotonicTimeMs holdTimeMs);
+bool relayEarlyArrivalsHold(RelayEarlyArrivals* self, RelayPacketPool* pool, RelaySerializeConnectionId connectionId,
+                            const RelayPacketRef* ref, MonotonicTimeMs now);
+size_t relayEarlyArrivalsTake(RelayEarlyArrivals* self, RelaySerializeConnectionId connectionId,
+                              RelayPacketRef* outRefs, size_t maxCount);
+void relayEarlyArrivalsExpire(RelayEarlyArrivals* self, RelayPacketPool* pool, MonotonicTimeMs now);
+
+#endif
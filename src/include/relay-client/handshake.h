@@ -0,0 +1,48 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_HANDSHAKE_H
+#define RELAY_CLIENT_HANDSHAKE_H
+
+#include <relay-client/retry.h>
+#include <stdbool.h>
+
+// Set as lastError of a listener or connector when the answer from the relay server could not be accepted
+#define RELAY_HANDSHAKE_ERR_REJECTED (-11)
+
+typedef enum RelayHandshakeResult {
+    RelayHandshakeResultPending,
+    RelayHandshakeResultSucceeded, ///< the relay server answered and the listener or connector can be used
+    RelayHandshakeResultTimedOut, ///< the handshake retry gave up without an answer
+    RelayHandshakeResultRejected, ///< the answer from the relay server could not be accepted
+    RelayHandshakeResultCancelled, ///< stopped by the application before there was an answer
+} RelayHandshakeResult;
+
+typedef void (*RelayHandshakeDoneFn)(void* userData, RelayHandshakeResult result);
+
+/// Called once, from inside relayClientUpdate() as soon as the result is known, so it runs on the thread that
+/// updates the client. For a client in a RelayClientPool that is the pool worker, which is why the pool sets its
+/// own completions and hands the results to the match thread as packets instead.
+typedef struct RelayHandshakeCompletion {
+    RelayHandshakeDoneFn onDone;
+    void* userData;
+} RelayHandshakeCompletion;
+
+typedef void (*RelayHandshakeResumeFn)(void* coroutine);
+
+/// Lets a coroutine wait for a handshake: it suspends until resume is called, then reads the result
+typedef struct RelayHandshakeAwaitable {
+    RelayHandshakeResult result;
+    RelayHandshakeResumeFn resume;
+    void* coroutine;
+} RelayHandshakeAwaitable;
+
+RelayHandshakeResult relayHandshakeResultFromError(int lastError);
+void relayHandshakeCompletionClear(RelayHandshakeCompletion* self);
+void relayHandshakeCompletionDeliver(RelayHandshakeCompletion* self, RelayHandshakeResult result);
+void relayHandshakeAwaitableInit(RelayHandshakeAwaitable* self, RelayHandshakeResumeFn resume, void* coroutine);
+RelayHandshakeCompletion relayHandshakeAwaitableCompletion(RelayHandshakeAwaitable* self);
+bool relayHandshakeAwaitableIsReady(const RelayHandshakeAwaitable* self);
+
+#endif
@@ -0,0 +1,86 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_IO_THREAD_H
+#define RELAY_CLIENT_IO_THREAD_H
+
+#include <clog/clog.h>
+#include <datagram-transport/transport.h>
+#include <datagram-transport/types.h>
+#include <monotonic-time/monotonic_time.h>
+#include <pthread.h>
+#include <relay-client/packet_pool.h>
+#include <relay-client/spsc_ring.h>
+#include <relay-client/transport_hooks.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ImprintAllocator;
+
+#define RELAY_IO_THREAD_DEFAULT_SLOT_COUNT (64)
+#define RELAY_IO_THREAD_OUT_DATAGRAM_CAPACITY (64)
+#define RELAY_IO_THREAD_BATCH_COUNT (32)
+// Only used when the transport has no pollFd hook to block on
+#define RELAY_IO_THREAD_IDLE_SLEEP_US (250)
+// Returned by the I/O thread transport when the out datagram ring is full
+#define RELAY_IO_THREAD_ERR_OUT_RING_FULL (-3)
+
+/// A packet pool slot that is lent to the I/O thread to receive into
+typedef struct RelayIoSlot {
+    uint8_t* octets;
+    RelayPacketSlotIndex slotIndex;
+    uint16_t octetCount;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    MonotonicTimeMs receivedAt;
+#endif
+} RelayIoSlot;
+
+typedef struct RelayIoDatagram {
+    size_t octetCount;
+    uint8_t octets[DATAGRAM_TRANSPORT_MAX_SIZE];
+} RelayIoDatagram;
+
+/// Only written by the I/O thread
+typedef struct RelayIoThreadStats {
+    size_t receivedDatagramCount;
+    size_t sentDatagramCount;
+    size_t receiveErrorCount;
+    size_t sendErrorCount;
+    size_t droppedDatagramCount; ///< not sent because of a send error
+} RelayIoThreadStats;
+
+/// Owns the transport to the relay server while it is running. The game thread lends it empty packet pool slots,
+/// gets them back filled with received datagrams, and hands it datagrams to send, all through SPSC rings.
+/// The packet pool itself is only touched by the game thread.
+/// When there is nothing to do it blocks in poll() on the pollFd of the transport and an eventfd that the game
+/// thread signals when it queues datagrams or lends slots.
+/// Only datagrams are moved to the I/O thread. Handshakes, their retries and timeouts, and the parsing and routing
+/// of what was received still run in relayClientUpdate() on the game thread, so a game thread that is late to
+/// update also delays handshakes.
+typedef struct RelayIoThread {
+    DatagramTransport transport;
+    RelayTransportHooks hooks;
+    RelaySpscRing freeSlots;
+    RelaySpscRing receivedSlots;
+    RelaySpscRing outDatagrams;
+    size_t slotCount;
+    size_t droppedOutDatagramCount;
+    RelayIoThreadStats stats;
+    int wakeFd;
+    int isSleeping;
+    int isRunning;
+    bool isSendBlocked; ///< the transport did not take all queued datagrams, only used by the I/O thread
+    bool isInitialized;
+    pthread_t thread;
+    Clog log;
+} RelayIoThread;
+
+void relayIoThreadInit(RelayIoThread* self, struct ImprintAllocator* memory, size_t slotCount, Clog log);
+int relayIoThreadStart(RelayIoThread* self, DatagramTransport transport, RelayTransportHooks hooks);
+void relayIoThreadStop(RelayIoThread* self);
+void relayIoThreadWake(RelayIoThread* self);
+DatagramTransport relayIoThreadTransport(RelayIoThread* self);
+
+#endif
@@ -11,6 +11,11 @@
 #include <datagram-transport/types.h>
 #include <discoid/circular_buffer.h>
 #include <monotonic-time/monotonic_time.h>
+#include <relay-client/buffer_pool.h>
+#include <relay-client/handshake.h>
+#include <relay-client/packet_queue.h>
+#include <relay-client/retry.h>
+#include <relay-client/stats.h>
 #include <relay-client/socket.h>
 #include <relay-serialize/client_out.h>
 #include <stdbool.h>
@@ -27,16 +32,39 @@ typedef enum RelayListenerState {
     RelayListenerStateConnected,
 } RelayListenerState;
 
+// Default connection capacity for a listener
 #define RELAY_CLIENT_MAX_LISTENER_CONNECTIONS_COUNT (32)
+// Connection indices are reported as uint8_t
+#define RELAY_LISTENER_MAX_CONNECTION_CAPACITY (255)
+// Default number of packets that can be queued for each connection, must be a power of two
+#define RELAY_LISTENER_CONNECTION_QUEUE_CAPACITY (32)
+// Connection mask for relayListenerBroadcast() that includes every connection, also those above index 63
+#define RELAY_LISTENER_BROADCAST_ALL (UINT64_MAX)
+// Connections that are handed to the socket in one batch by relayListenerBroadcast()
+#define RELAY_LISTENER_BROADCAST_BATCH_COUNT (32)
 struct ImprintAllocator;
 
+/// Identifies a connection index together with the generation of the connection that occupied it,
+/// so a handle to a connection that has been removed is not mistaken for a newer one on the same index
+typedef uint32_t RelayConnectionHandle;
+
 typedef struct RelayConnection {
     RelaySerializeConnectionId connectionId;
+    RelayPacketHeader header;
+    uint16_t generation;
+    MonotonicTimeMs lastReceivedAt;
+    RelayPacketQueue inQueue;
+    RelayPacketDropStats dropStats;
+    RelayTrafficStats traffic;
+    size_t inQueueHighWater;
+    bool isReady;
 } RelayConnection;
 
 typedef struct RelayListener {
-    int waitTime;
     RelayListenerState state;
+    RelayRetry retry;
+    int lastError;
+    RelayHandshakeCompletion completion;
     RelaySerializeListenerId listenerId;
 
     RelaySerializeApplicationId applicationId;
@@ -45,10 +73,28 @@ typedef struct RelayListener {
 
     DatagramTransportMulti multiTransport;
     RelaySerializeUserSessionId userSessionId;
-    DatagramTransport transportToRelayServer;
-    DiscoidBuffer inBuffer;
-    RelayConnection connections[RELAY_CLIENT_MAX_LISTENER_CONNECTIONS_COUNT];
-    uint8_t tempBuffer[DATAGRAM_TRANSPORT_MAX_SIZE];
+    RelaySocket* socket;
+    RelayPacketPool* pool;
+    RelayBufferPool* bufferPool;
+    RelayConnection* connections;
+    size_t connectionCapacity;
+    size_t connectionQueueCapacity;
+    uint16_t nextGeneration;
+    RelayPacketOverflowPolicy overflowPolicy;
+    RelayPacketDropStats dropStats;
+    RelayTrafficStats traffic;
+    size_t inQueueHighWater;
+    size_t queuedPacketCount; ///< summed over the connection queues
+    size_t handshakeRetryCount;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    RelayLatencyHistogram residency; ///< from being queued until it is borrowed by the application
+    RelayLatencyHistogram dispatchLatency; ///< from being received from the transport until it is borrowed
+#endif
+    size_t reservedConnectionIndex;
+    uint8_t* readyConnections;
+    size_t readyCapacity;
+    size_t readyHead;
+    size_t readyTail;
     char prefix[33];
     Clog log;
 } RelayListener;
@@ -57,21 +103,43 @@ typedef struct RelayListenerSetup {
     RelaySerializeUserSessionId authenticatedUserSessionId;
     RelaySerializeApplicationId applicationId;
     RelaySerializeChannelId channelId;
-    DatagramTransport transportToRelayServer;
+    /// sent with every listen request, so the response can be matched to this listener
+    RelaySerializeRequestId requestId;
+    RelaySocket* socket;
+    RelayRetrySetup retry;
 } RelayListenerSetup;
 
-int relayListenerInit(RelayListener* self, struct ImprintAllocator* memory, const char* prefix, Clog log);
+int relayListenerInit(RelayListener* self, RelayPacketPool* pool, RelayBufferPool* bufferPool,
+                      size_t connectionCapacity, size_t connectionQueueCapacity, const char* prefix, Clog log);
+size_t relayListenerBufferOctetCount(size_t connectionCapacity, size_t connectionQueueCapacity);
+void relayListenerSetOverflowPolicy(RelayListener* self, RelayPacketOverflowPolicy policy);
 void relayListenerReInit(RelayListener* self, const RelayListenerSetup* setup);
 void relayListenerDestroy(RelayListener* self);
 void relayListenerDisconnect(RelayListener* self);
+void relayListenerSetCompletion(RelayListener* self, RelayHandshakeCompletion completion);
+void relayListenerAbortHandshake(RelayListener* self, int error, RelayHandshakeResult result);
 int relayListenerUpdate(RelayListener* self, MonotonicTimeMs now);
 ssize_t relayListenerPushPacket(RelayListener* self, size_t relayConnectionIndex, const uint8_t* data,
                                 size_t octetCountInPacket);
+ssize_t relayListenerPushPacketRef(RelayListener* self, const RelayPacketRef* ref);
 ssize_t relayListenerFindFreeConnectionIndex(RelayListener* self);
 RelayConnection* relayListenerFindConnection(RelayListener* self, RelaySerializeConnectionId connectionId);
+void relayListenerAddConnection(RelayListener* self, size_t connectionIndex, RelaySerializeConnectionId connectionId,
+                                MonotonicTimeMs now);
+void relayListenerRemoveConnection(RelayListener* self, size_t connectionIndex);
+RelayConnectionHandle relayListenerConnectionHandle(const RelayListener* self, size_t connectionIndex);
+ssize_t relayListenerConnectionIndexFromHandle(const RelayListener* self, RelayConnectionHandle handle);
+ssize_t relayListenerSendToConnectionHandle(RelayListener* self, RelayConnectionHandle handle, const uint8_t* data,
+                                            size_t octetCount);
 ssize_t relayListenerSendToConnectionIndex(RelayListener* self, size_t connectionIndex, const uint8_t* data,
                                            size_t octetCount);
+ssize_t relayListenerBroadcast(RelayListener* self, uint64_t connectionMask, const uint8_t* data,
+                               size_t octetCount);
+uint8_t* relayListenerReserve(RelayListener* self, size_t connectionIndex, size_t* outMaxOctetCount);
+int relayListenerCommit(RelayListener* self, size_t octetCount);
 ssize_t relayListenerReceivePacket(RelayListener* self, uint8_t* outConnectionIndex, uint8_t* octets,
                                    size_t maxOctetCount);
+int relayListenerBorrowPacket(RelayListener* self, RelayReceivedPacket* outPacket);
+void relayListenerReleasePacket(RelayListener* self, const RelayReceivedPacket* packet);
 
 #endif
@@ -0,0 +1,40 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_METRICS_H
+#define RELAY_CLIENT_METRICS_H
+
+#include <relay-client/client.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/// Counters of a client, summed over its listeners and connectors. Cheap enough to take every frame.
+typedef struct RelayClientMetrics {
+    RelayClientStats client;
+    RelaySocketStats socket;
+    RelayEarlyArrivalStats earlyArrivals;
+    RelayPendingRequestStats pendingRequests;
+    RelayTrafficStats listenerTraffic;
+    RelayTrafficStats connectorTraffic;
+    RelayPacketDropStats listenerDrops;
+    RelayPacketDropStats connectorDrops;
+    size_t handshakeRetryCount;
+    size_t inQueueHighWater;
+    size_t activeListenerCount;
+    size_t activeConnectorCount;
+    size_t activeConnectionCount;
+    size_t pendingRequestCount;
+    size_t packetPoolSlotCount;
+    size_t packetPoolFreeCount;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    RelayLatencyHistogram residency;
+    RelayLatencyHistogram dispatchLatency;
+    RelayLatencyHistogram sendLatency;
+#endif
+} RelayClientMetrics;
+
+void relayClientMetricsSnapshot(const RelayClient* self, RelayClientMetrics* outMetrics);
+ssize_t relayClientMetricsWritePrometheus(const RelayClient* self, char* target, size_t maxOctetCount);
+
+#endif
@@ -0,0 +1,15 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_MICROSECOND_CLOCK_H
+#define RELAY_CLIENT_MICROSECOND_CLOCK_H
+
+#include <stdint.h>
+
+/// Monotonic microseconds from an unspecified start, for measuring durations that are well below a millisecond
+typedef uint64_t RelayMicroseconds;
+
+RelayMicroseconds relayMicrosecondClockNow(void);
+
+#endif
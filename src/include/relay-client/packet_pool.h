@@ -0,0 +1,49 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_PACKET_POOL_H
+#define RELAY_CLIENT_PACKET_POOL_H
+
+#include <datagram-transport/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ImprintAllocator;
+
+typedef uint16_t RelayPacketSlotIndex;
+
+#define RELAY_PACKET_POOL_DEFAULT_SLOT_COUNT (256)
+#define RELAY_PACKET_SLOT_OCTET_COUNT (DATAGRAM_TRANSPORT_MAX_SIZE)
+#define RELAY_PACKET_SLOT_NONE ((RelayPacketSlotIndex) UINT16_MAX)
+
+// Slots are allocated in chunks of (1 << RELAY_PACKET_POOL_CHUNK_SHIFT) when they are first needed
+#define RELAY_PACKET_POOL_CHUNK_SHIFT (5)
+#define RELAY_PACKET_POOL_CHUNK_SLOT_COUNT (1u << RELAY_PACKET_POOL_CHUNK_SHIFT)
+
+/// Fixed size slots that datagrams from the relay server are received into.
+/// Listener and connector queues refer to the slots, so a payload stays in place until it is released.
+/// A datagram with several coalesced packets is referenced once for every packet in it.
+typedef struct RelayPacketPool {
+    uint8_t** chunks;
+    size_t chunkCount;
+    uint8_t* refCounts;
+    RelayPacketSlotIndex* freeSlots;
+    size_t freeCount;
+    size_t slotCount;
+    size_t maxSlotCount;
+    struct ImprintAllocator* memory;
+} RelayPacketPool;
+
+int relayPacketPoolInit(RelayPacketPool* self, struct ImprintAllocator* memory, size_t maxSlotCount);
+int relayPacketPoolAlloc(RelayPacketPool* self, RelayPacketSlotIndex* outSlotIndex);
+void relayPacketPoolRetain(RelayPacketPool* self, RelayPacketSlotIndex slotIndex);
+void relayPacketPoolFree(RelayPacketPool* self, RelayPacketSlotIndex slotIndex);
+
+static inline uint8_t* relayPacketPoolSlotOctets(const RelayPacketPool* self, RelayPacketSlotIndex slotIndex)
+{
+    return self->chunks[slotIndex >> RELAY_PACKET_POOL_CHUNK_SHIFT] +
+           (size_t) (slotIndex & (RELAY_PACKET_POOL_CHUNK_SLOT_COUNT - 1)) * RELAY_PACKET_SLOT_OCTET_COUNT;
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_PACKET_QUEUE_H
+#define RELAY_CLIENT_PACKET_QUEUE_H
+
+#include <relay-client/packet_pool.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// A payload inside a packet pool slot
+typedef struct RelayPacketRef {
+    RelayPacketSlotIndex slotIndex;
+    uint16_t octetOffset;
+    uint16_t octetCount;
+    uint16_t connectionIndex;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    uint32_t receivedAtMs; ///< when the datagram was received from the transport, truncated MonotonicTimeMs
+    uint32_t queuedAtMs; ///< when it was pushed to the listener or connector queue, truncated MonotonicTimeMs
+#endif
+} RelayPacketRef;
+
+/// A received payload that is borrowed by the application until it is released
+typedef struct RelayReceivedPacket {
+    const uint8_t* octets;
+    size_t octetCount;
+    uint8_t connectionIndex;
+    RelayPacketSlotIndex slotIndex;
+} RelayReceivedPacket;
+
+/// What to do when a packet arrives and the queue is full
+typedef enum RelayPacketOverflowPolicy {
+    RelayPacketOverflowPolicyDropNewest, ///< keep the queued packets and discard the arriving one
+    RelayPacketOverflowPolicyDropOldest, ///< discard the oldest queued packet to make room
+    RelayPacketOverflowPolicyKeepLatest, ///< only the most recent packet is kept, older ones are always discarded
+} RelayPacketOverflowPolicy;
+
+typedef struct RelayPacketDropStats {
+    size_t droppedPacketCount;
+    size_t droppedOctetCount;
+} RelayPacketDropStats;
+
+/// FIFO of packet references. Capacity must be a power of two.
+typedef struct RelayPacketQueue {
+    RelayPacketRef* refs;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+} RelayPacketQueue;
+
+void relayPacketQueueInit(RelayPacketQueue* self, RelayPacketRef* refs, size_t capacity);
+void relayPacketQueueClear(RelayPacketQueue* self, RelayPacketPool* pool);
+bool relayPacketQueuePush(RelayPacketQueue* self, const RelayPacketRef* ref);
+bool relayPacketQueuePop(RelayPacketQueue* self, RelayPacketRef* outRef);
+bool relayPacketQueuePushWithPolicy(RelayPacketQueue* self, RelayPacketPool* pool, const RelayPacketRef* ref,
+                                    RelayPacketOverflowPolicy policy, RelayPacketDropStats* stats);
+
+static inline size_t relayPacketQueueCount(const RelayPacketQueue* self)
+{
+    return self->tail - self->head;
+}
+
+#endif
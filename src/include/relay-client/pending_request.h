@@ -0,0 +1,57 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_PENDING_REQUEST_H
+#define RELAY_CLIENT_PENDING_REQUEST_H
+
+#include <relay-serialize/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One entry for every request id that fits in the octet sent on the wire, zero is never handed out
+#define RELAY_PENDING_REQUEST_CAPACITY (256)
+
+typedef enum RelayPendingRequestKind {
+    RelayPendingRequestKindNone,
+    RelayPendingRequestKindListen,
+    RelayPendingRequestKindConnect,
+} RelayPendingRequestKind;
+
+typedef struct RelayPendingRequest {
+    RelayPendingRequestKind kind;
+    uint16_t ownerIndex; ///< index of the listener or connector that sent the request
+} RelayPendingRequest;
+
+typedef struct RelayPendingRequestStats {
+    size_t issuedCount;
+    size_t answeredCount;
+    size_t expiredCount;
+    size_t unknownResponseCount;
+    size_t exhaustedCount;
+} RelayPendingRequestStats;
+
+/// Handshake requests that are waiting for a response from the relay server, indexed by request id.
+/// A request expires when the handshake retry of its owner gives up.
+typedef struct RelayPendingRequests {
+    RelayPendingRequest entries[RELAY_PENDING_REQUEST_CAPACITY];
+    size_t count;
+    size_t nextRequestId;
+    RelayPendingRequestStats stats;
+} RelayPendingRequests;
+
+void relayPendingRequestsInit(RelayPendingRequests* self);
+int relayPendingRequestsAdd(RelayPendingRequests* self, RelayPendingRequestKind kind, size_t ownerIndex,
+                            RelaySerializeRequestId* outRequestId);
+int relayPendingRequestsFind(const RelayPendingRequests* self, RelaySerializeRequestId requestId,
+                             RelayPendingRequestKind kind);
+bool relayPendingRequestsRemove(RelayPendingRequests* self, RelaySerializeRequestId requestId,
+                                RelayPendingRequestKind kind, size_t ownerIndex);
+void relayPendingRequestsAnswer(RelayPendingRequests* self, RelaySerializeRequestId requestId,
+                                RelayPendingRequestKind kind, size_t ownerIndex);
+void relayPendingRequestsIgnore(RelayPendingRequests* self);
+void relayPendingRequestsExpire(RelayPendingRequests* self, RelaySerializeRequestId requestId,
+                                RelayPendingRequestKind kind, size_t ownerIndex);
+
+#endif
@@ -0,0 +1,38 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_PREWARM_H
+#define RELAY_CLIENT_PREWARM_H
+
+#include <monotonic-time/monotonic_time.h>
+#include <relay-client/client.h>
+#include <stddef.h>
+
+#define RELAY_CLIENT_PREWARM_CAPACITY (16)
+
+typedef struct RelayConnectTarget {
+    RelaySerializeUserId userId;
+    RelaySerializeApplicationId applicationId;
+    RelaySerializeChannelId channelId;
+} RelayConnectTarget;
+
+/// Connectors that were started together before it is known which one is needed, for example one for each
+/// candidate host of a match. One of them is claimed when the match is decided and the rest are released.
+/// A connector that gives up can be reused by the client for another connect, so the request id it was started
+/// with is kept to tell if it is still the prewarmed one.
+typedef struct RelayPrewarmedConnects {
+    RelayConnectTarget targets[RELAY_CLIENT_PREWARM_CAPACITY];
+    RelayConnector* connectors[RELAY_CLIENT_PREWARM_CAPACITY];
+    RelaySerializeRequestId requestIds[RELAY_CLIENT_PREWARM_CAPACITY];
+    size_t count;
+} RelayPrewarmedConnects;
+
+int relayClientPrewarmConnects(RelayClient* self, const RelayConnectTarget* targets, size_t targetCount,
+                               MonotonicTimeMs now, RelayPrewarmedConnects* outPrewarmed);
+size_t relayPrewarmedConnectsReadyCount(const RelayPrewarmedConnects* self);
+RelayConnector* relayClientClaimPrewarmed(RelayClient* self, RelayPrewarmedConnects* prewarmed,
+                                          const RelayConnectTarget* target);
+void relayClientReleasePrewarmed(RelayClient* self, RelayPrewarmedConnects* prewarmed);
+
+#endif
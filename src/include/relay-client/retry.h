@@ -0,0 +1,48 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_RETRY_H
+#define RELAY_CLIENT_RETRY_H
+
+#include <monotonic-time/monotonic_time.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RELAY_RETRY_DEFAULT_INITIAL_TIMEOUT_MS (250)
+#define RELAY_RETRY_DEFAULT_MAX_TIMEOUT_MS (4000)
+#define RELAY_RETRY_DEFAULT_MAX_ATTEMPT_COUNT (8)
+#define RELAY_RETRY_DEFAULT_JITTER_PERCENT (25)
+
+// Returned when a handshake gave up after the max attempt count
+#define RELAY_RETRY_ERR_TIMED_OUT (-10)
+
+typedef struct RelayRetrySetup {
+    MonotonicTimeMs initialTimeoutMs;
+    MonotonicTimeMs maxTimeoutMs;
+    size_t maxAttemptCount;
+    /// each wait is randomly moved up to this percentage earlier or later
+    size_t jitterPercent;
+} RelayRetrySetup;
+
+typedef enum RelayRetryAction {
+    RelayRetryActionWait,
+    RelayRetryActionSend,
+    RelayRetryActionTimedOut,
+} RelayRetryAction;
+
+/// Schedules resends of a request on wall time, with exponential backoff and jitter
+typedef struct RelayRetry {
+    RelayRetrySetup setup;
+    MonotonicTimeMs timeoutMs;
+    MonotonicTimeMs nextAttemptAt;
+    size_t attemptCount;
+    uint32_t randomState;
+} RelayRetry;
+
+void relayRetrySetupDefaults(RelayRetrySetup* setup);
+void relayRetryInit(RelayRetry* self, const RelayRetrySetup* setup, uint64_t seed);
+void relayRetryReset(RelayRetry* self);
+RelayRetryAction relayRetryUpdate(RelayRetry* self, MonotonicTimeMs now);
+
+#endif
@@ -0,0 +1,46 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_ROUTE_H
+#define RELAY_CLIENT_ROUTE_H
+
+#include <relay-serialize/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ImprintAllocator;
+
+typedef enum RelayRouteKind {
+    RelayRouteKindNone,
+    RelayRouteKindListener,
+    RelayRouteKindConnector,
+} RelayRouteKind;
+
+/// Where packets for a connection id should be delivered.
+/// For a listener route, ownerIndex is the listener index and connectionIndex the slot in that listener.
+/// For a connector route, ownerIndex is the connector index.
+typedef struct RelayRoute {
+    RelaySerializeConnectionId connectionId;
+    RelayRouteKind kind;
+    uint16_t ownerIndex;
+    uint16_t connectionIndex;
+} RelayRoute;
+
+/// Open addressing hash table from connection id to route.
+/// Connection id zero is never assigned by the relay server and is used to mark free entries.
+typedef struct RelayRoutes {
+    RelayRoute* entries;
+    size_t capacity;
+    size_t mask;
+    size_t count;
+} RelayRoutes;
+
+void relayRoutesInit(RelayRoutes* self, struct ImprintAllocator* memory, size_t maxRouteCount);
+void relayRoutesReset(RelayRoutes* self);
+int relayRoutesInsert(RelayRoutes* self, RelaySerializeConnectionId connectionId, RelayRouteKind kind,
+                      size_t ownerIndex, size_t connectionIndex);
+const RelayRoute* relayRoutesFind(const RelayRoutes* self, RelaySerializeConnectionId connectionId);
+int relayRoutesRemove(RelayRoutes* self, RelaySerializeConnectionId connectionId);
+
+#endif
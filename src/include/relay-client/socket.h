@@ -8,13 +8,105 @@
 #include <clog/clog.h>
 #include <datagram-transport/multi.h>
 #include <datagram-transport/transport.h>
+#include <datagram-transport/types.h>
 #include <discoid/circular_buffer.h>
 #include <monotonic-time/monotonic_time.h>
+#include <relay-client/stats.h>
+#include <relay-client/transport_hooks.h>
 #include <relay-serialize/client_out.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
-int relaySocketSendPacket(DatagramTransport transportToRelayServer, RelaySerializeUserSessionId userSessionId,
+struct ImprintAllocator;
+
+#define RELAY_SOCKET_OUT_QUEUE_CAPACITY (64)
+#define RELAY_SOCKET_NO_OPEN_DATAGRAM (SIZE_MAX)
+
+typedef struct RelaySocketOutQueue {
+    uint8_t* octets;
+    RelayDatagram* datagrams;
+    size_t count;
+    size_t capacity;
+} RelaySocketOutQueue;
+
+typedef struct RelaySocketStats {
+    size_t datagramsSent;
+    size_t octetsSent;
+    size_t sendErrorCount;
+    size_t transportSendCalls;
+    size_t flushCount;
+    size_t coalescedPacketCount; ///< packets that were appended to an already queued datagram
+} RelaySocketStats;
+
+#define RELAY_PACKET_HEADER_MAX_OCTET_COUNT (32)
+// octetCountOffset of a header where the payload octet count could not be located
+#define RELAY_PACKET_HEADER_NO_OCTET_COUNT_OFFSET (UINT8_MAX)
+// Returned by relayPacketHeaderInit() when the header can be used, but is serialized again for every packet
+#define RELAY_PACKET_HEADER_ERR_NOT_CACHED (-2)
+
+/// The relay header for packets on a connection, serialized once when the connection id is known
+typedef struct RelayPacketHeader {
+    uint8_t octets[RELAY_PACKET_HEADER_MAX_OCTET_COUNT];
+    uint8_t octetCount;
+    uint8_t octetCountOffset; ///< where the payload octet count is written
+    RelaySerializeUserSessionId userSessionId; ///< to serialize the whole header when octetCountOffset is unknown
+    RelaySerializeConnectionId connectionId;
+} RelayPacketHeader;
+
+/// A packet that is being written directly into its outgoing datagram
+typedef struct RelaySocketReservation {
+    bool isActive;
+    bool isInOutQueue;
+    uint8_t* datagram;
+    const RelayPacketHeader* header;
+} RelaySocketReservation;
+
+/// The connection to the relay server that is shared by the client, listeners and connectors.
+/// In queued mode datagrams are collected in the out queue and sent on relaySocketFlush().
+/// With coalescing, packets are appended to the last queued datagram as long as they fit.
+/// scratchBuf is shared by everyone that needs to serialize a datagram before sending it.
+typedef struct RelaySocket {
+    DatagramTransport transport;
+    RelayTransportHooks hooks;
+    bool useOutQueue;
+    bool useCoalescing;
+    RelaySocketOutQueue outQueue;
+    size_t openDatagramIndex; ///< the queued datagram that packets can be appended to
+
+    RelaySocketStats stats;
+    RelaySocketReservation reservation;
+    RelayPacketHeader reservationHeader;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    RelayLatencyHistogram sendLatency; ///< from being sent by the application until handed to the transport
+    MonotonicTimeMs oldestQueuedAt;
+#endif
+    struct ImprintAllocator* memory;
+    uint8_t sendBuf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    uint8_t scratchBuf[DATAGRAM_TRANSPORT_MAX_SIZE];
+    Clog log;
+} RelaySocket;
+
+int relayPacketHeaderInit(RelayPacketHeader* self, RelaySerializeUserSessionId userSessionId,
+                          RelaySerializeConnectionId connectionId);
+
+void relaySocketInit(RelaySocket* self, DatagramTransport transport, struct ImprintAllocator* memory, Clog log);
+void relaySocketSetOutQueueEnabled(RelaySocket* self, bool enabled);
+void relaySocketSetCoalescingEnabled(RelaySocket* self, bool enabled);
+int relaySocketSendDatagram(RelaySocket* self, const uint8_t* octets, size_t octetCount);
+int relaySocketSendPacket(RelaySocket* self, RelaySerializeUserSessionId userSessionId,
                           RelaySerializeConnectionId connectionId, const uint8_t* octets, size_t octetCount);
+uint8_t* relaySocketReservePacket(RelaySocket* self, RelaySerializeUserSessionId userSessionId,
+                                  RelaySerializeConnectionId connectionId, size_t* outMaxOctetCount);
+uint8_t* relaySocketReservePacketWithHeader(RelaySocket* self, const RelayPacketHeader* header,
+                                            size_t* outMaxOctetCount);
+int relaySocketCommitPacket(RelaySocket* self, size_t octetCount);
+int relaySocketSendPacketWithHeader(RelaySocket* self, const RelayPacketHeader* header, const uint8_t* octets,
+                                    size_t octetCount);
+int relaySocketSendPacketToMany(RelaySocket* self, const RelayPacketHeader* const* headers, size_t connectionCount,
+                                const uint8_t* octets, size_t octetCount);
+int relaySocketFlush(RelaySocket* self);
+bool relaySocketBeginBatch(RelaySocket* self);
+int relaySocketEndBatch(RelaySocket* self, bool startedBatch);
+
 #endif
@@ -0,0 +1,40 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_SPSC_RING_H
+#define RELAY_CLIENT_SPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct ImprintAllocator;
+
+#define RELAY_SPSC_RING_CACHE_LINE_OCTET_COUNT (64)
+
+/// Lock free ring of fixed size items between exactly one producer thread and one consumer thread.
+/// Items are written and read in place, the producer commits and the consumer releases them in batches.
+/// head and tail are on separate cache lines so the two threads do not invalidate each other on every item.
+typedef struct RelaySpscRing {
+    uint8_t* items;
+    size_t itemOctetCount;
+    size_t capacity;
+    uint8_t padding0[RELAY_SPSC_RING_CACHE_LINE_OCTET_COUNT];
+    size_t head; ///< written by the consumer
+    uint8_t padding1[RELAY_SPSC_RING_CACHE_LINE_OCTET_COUNT - sizeof(size_t)];
+    size_t tail; ///< written by the producer
+    uint8_t padding2[RELAY_SPSC_RING_CACHE_LINE_OCTET_COUNT - sizeof(size_t)];
+} RelaySpscRing;
+
+void relaySpscRingInit(RelaySpscRing* self, struct ImprintAllocator* memory, size_t itemOctetCount, size_t capacity);
+void relaySpscRingReset(RelaySpscRing* self);
+
+size_t relaySpscRingProducerAvailable(const RelaySpscRing* self);
+void* relaySpscRingProducerItem(RelaySpscRing* self, size_t index);
+void relaySpscRingProducerCommit(RelaySpscRing* self, size_t count);
+
+size_t relaySpscRingConsumerAvailable(const RelaySpscRing* self);
+void* relaySpscRingConsumerItem(RelaySpscRing* self, size_t index);
+void relaySpscRingConsumerRelease(RelaySpscRing* self, size_t count);
+
+#endif
@@ -0,0 +1,82 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_STATS_H
+#define RELAY_CLIENT_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Application packets (relay payloads) in each direction
+typedef struct RelayTrafficStats {
+    size_t packetsIn;
+    size_t octetsIn;
+    size_t packetsOut;
+    size_t octetsOut;
+} RelayTrafficStats;
+
+static inline void relayTrafficStatsAddIn(RelayTrafficStats* self, size_t octetCount)
+{
+    self->packetsIn++;
+    self->octetsIn += octetCount;
+}
+
+static inline void relayTrafficStatsAddOut(RelayTrafficStats* self, size_t octetCount)
+{
+    self->packetsOut++;
+    self->octetsOut += octetCount;
+}
+
+// Bucket i counts samples of at most 2^(i-1) ms (bucket 0 is 0 ms), the last bucket counts everything above
+#define RELAY_LATENCY_HISTOGRAM_BUCKET_COUNT (12)
+
+/// Fixed bucket histogram of millisecond durations
+typedef struct RelayLatencyHistogram {
+    size_t bucketCounts[RELAY_LATENCY_HISTOGRAM_BUCKET_COUNT];
+    size_t sampleCount;
+    uint64_t totalMs;
+    uint32_t maxMs;
+} RelayLatencyHistogram;
+
+/// @return the largest duration in ms that is counted in the bucket, UINT32_MAX for the last one
+static inline uint32_t relayLatencyHistogramBucketUpperBound(size_t bucketIndex)
+{
+    if (bucketIndex == 0) {
+        return 0;
+    }
+    if (bucketIndex >= RELAY_LATENCY_HISTOGRAM_BUCKET_COUNT - 1) {
+        return UINT32_MAX;
+    }
+
+    return 1u << (bucketIndex - 1);
+}
+
+static inline void relayLatencyHistogramAdd(RelayLatencyHistogram* self, uint32_t durationMs)
+{
+    size_t bucketIndex = 0;
+    while (durationMs > relayLatencyHistogramBucketUpperBound(bucketIndex)) {
+        bucketIndex++;
+    }
+
+    self->bucketCounts[bucketIndex]++;
+    self->sampleCount++;
+    self->totalMs += durationMs;
+    if (durationMs > self->maxMs) {
+        self->maxMs = durationMs;
+    }
+}
+
+static inline void relayLatencyHistogramMerge(RelayLatencyHistogram* self, const RelayLatencyHistogram* other)
+{
+    for (size_t i = 0; i < RELAY_LATENCY_HISTOGRAM_BUCKET_COUNT; ++i) {
+        self->bucketCounts[i] += other->bucketCounts[i];
+    }
+    self->sampleCount += other->sampleCount;
+    self->totalMs += other->totalMs;
+    if (other->maxMs > self->maxMs) {
+        self->maxMs = other->maxMs;
+    }
+}
+
+#endif
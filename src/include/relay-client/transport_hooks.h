@@ -0,0 +1,38 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#ifndef RELAY_CLIENT_TRANSPORT_HOOKS_H
+#define RELAY_CLIENT_TRANSPORT_HOOKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct RelayDatagram {
+    uint8_t* octets;
+    size_t octetCount;
+} RelayDatagram;
+
+/// Receives up to maxCount datagrams in one call (e.g. recvmmsg()).
+/// Each datagrams[i].octets points to a buffer of DATAGRAM_TRANSPORT_MAX_SIZE octets, the hook sets octetCount.
+/// @return number of datagrams received, zero if none are waiting, negative on error
+typedef ssize_t (*RelayTransportReceiveManyFn)(void* self, RelayDatagram* datagrams, size_t maxCount);
+
+/// Sends count datagrams in one call (e.g. sendmmsg()).
+/// @return number of datagrams sent, negative on error
+typedef int (*RelayTransportSendManyFn)(void* self, const RelayDatagram* datagrams, size_t count);
+
+/// @return a file descriptor that becomes readable when datagrams arrive (e.g. for epoll), negative if there is none
+typedef int (*RelayTransportPollFdFn)(void* self);
+
+/// Optional extensions to the DatagramTransport to the relay server.
+/// Hooks that are not set fall back to the per datagram functions in DatagramTransport.
+typedef struct RelayTransportHooks {
+    void* self;
+    RelayTransportReceiveManyFn receiveMany;
+    RelayTransportSendManyFn sendMany;
+    RelayTransportPollFdFn pollFd;
+} RelayTransportHooks;
+
+#endif
@@ -0,0 +1,37 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <imprint/allocator.h>
+#include <relay-client/buffer_pool.h>
+
+void relayBufferPoolInit(RelayBufferPool* self, struct ImprintAllocator* memory, size_t blockOctetCount)
+{
+    if (blockOctetCount < sizeof(RelayBufferPoolBlock)) {
+        blockOctetCount = sizeof(RelayBufferPoolBlock);
+    }
+    self->freeBlocks = 0;
+    self->blockOctetCount = blockOctetCount;
+    self->allocatedBlockCount = 0;
+    self->memory = memory;
+}
+
+void* relayBufferPoolAlloc(RelayBufferPool* self)
+{
+    RelayBufferPoolBlock* block = self->freeBlocks;
+    if (block != 0) {
+        self->freeBlocks = block->next;
+        return block;
+    }
+
+    self->allocatedBlockCount++;
+
+    return IMPRINT_ALLOC(self->memory, self->blockOctetCount, "relay buffer pool block");
+}
+
+void relayBufferPoolFree(RelayBufferPool* self, void* block)
+{
+    RelayBufferPoolBlock* freeBlock = (RelayBufferPoolBlock*) block;
+    freeBlock->next = self->freeBlocks;
+    self->freeBlocks = freeBlock;
+}
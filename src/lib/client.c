@@ -4,26 +4,30 @@
  *--------------------------------------------------------------------------------------------------------*/
 #include <datagram-transport/types.h>
 #include <flood/in_stream.h>
+#include <imprint/allocator.h>
 #include <inttypes.h>
 #include <relay-client/client.h>
 #include <relay-serialize/client_in.h>
 #include <relay-serialize/debug.h>
 
+/// A listener that was disconnected with relayListenerDisconnect() or relayListenerDestroy(), instead of
+/// relayClientStopListen(), leaves its routes behind. They are removed when they are looked up.
 static int relayClientFindListenerAndConnection(RelayClient* self, RelaySerializeConnectionId connectionId,
                                                 RelayListener** outListener, size_t* outConnectionIndex)
 
 {
-    for (size_t i = 0; i < RELAY_CLIENT_LISTENER_CAPACITY; ++i) {
-        RelayListener* listener = &self->listeners[i];
-        for (size_t connectionIndex = 0; connectionIndex < RELAY_CLIENT_MAX_LISTENER_CONNECTIONS_COUNT;
-             ++connectionIndex) {
-            RelayConnection* connection = &listener->connections[connectionIndex];
-            if (connection->connectionId == connectionId) {
-                *outConnectionIndex = connectionIndex;
-                *outListener = listener;
-                return 1;
-            }
+    const RelayRoute* route = relayRoutesFind(&self->routes, connectionId);
+    if (route != 0 && route->kind == RelayRouteKindListener) {
+        RelayListener* listener = &self->listeners[route->ownerIndex];
+        size_t connectionIndex = route->connectionIndex;
+        if (listener->connections != 0 && connectionIndex < listener->connectionCapacity &&
+            listener->connections[connectionIndex].connectionId == connectionId) {
+            *outConnectionIndex = connectionIndex;
+            *outListener = listener;
+            return 1;
         }
+        CLOG_C_DEBUG(&self->log, "removing stale route for connection id %" PRIX64, connectionId)
+        relayRoutesRemove(&self->routes, connectionId);
     }
 
     *outConnectionIndex = 0;
@@ -62,36 +66,72 @@ static int relayClientFindListenerAndConnectionEx(RelayClient* self, RelayListen
 static RelayConnector* relayClientFindConnector(RelayClient* self, RelaySerializeConnectionId connectionId)
 
 {
-    for (size_t connectorIndex = 0; connectorIndex < RELAY_CLIENT_CONNECTION_CAPACITY; ++connectorIndex) {
-        RelayConnector* connector = &self->connectors[connectorIndex];
-        if (connector->connectionId == connectionId) {
-            return connector;
-        }
+    const RelayRoute* route = relayRoutesFind(&self->routes, connectionId);
+    if (route == 0 || route->kind != RelayRouteKindConnector) {
+        return 0;
     }
 
-    return 0;
+    RelayConnector* connector = &self->connectors[route->ownerIndex];
+    if (connector->connectionId != connectionId) {
+        // left behind by relayConnectorDisconnect() that was not called through relayClientStopConnect()
+        relayRoutesRemove(&self->routes, connectionId);
+        return 0;
+    }
+
+    return connector;
 }
 
-static int onIncomingPacket(RelayClient* self, FldInStream* inStream)
+static void relayClientReleaseSlot(RelayClient* self, RelayPacketSlotIndex slotIndex)
 {
-    RelaySerializeServerPacketFromServerToClient packetFromServerToClient;
+    if (slotIndex != RELAY_PACKET_SLOT_NONE) {
+        relayPacketPoolFree(&self->packetPool, slotIndex);
+    }
+}
 
-    int packetHeaderErr = relaySerializeClientInPacketFromServer(inStream, &packetFromServerToClient);
-    if (packetHeaderErr < 0) {
-        CLOG_C_SOFT_ERROR(&self->log, "could not deserialize in packet header")
-        return packetHeaderErr;
+static void relayClientRetainSlot(RelayClient* self, RelayPacketSlotIndex slotIndex)
+{
+    if (slotIndex != RELAY_PACKET_SLOT_NONE) {
+        relayPacketPoolRetain(&self->packetPool, slotIndex);
+    }
+}
+
+/// Drops the packet if the listener or connector already has its share of the packet pool queued,
+/// so an endpoint that the application does not drain can not starve the others
+static bool relayClientIsOverQuota(RelayClient* self, size_t queuedPacketCount, const RelayPacketRef* ref,
+                                   RelayPacketDropStats* dropStats)
+{
+    if (self->endpointPacketQuota == 0 || queuedPacketCount < self->endpointPacketQuota) {
+        return false;
     }
 
+    relayClientReleaseSlot(self, ref->slotIndex);
+    dropStats->droppedPacketCount++;
+    dropStats->droppedOctetCount += ref->octetCount;
+    self->stats.endpointQuotaDropCount++;
+
+    return true;
+}
+
+/// Pushes the packet to the listener connection or connector that the connection id is routed to.
+/// Ownership of the slot reference moves with it, unless there is no route for the connection id.
+/// @return -2 if there is no route
+static int relayClientDeliverPacket(RelayClient* self, RelaySerializeConnectionId connectionId, RelayPacketRef* ref)
+{
     RelayListener* listener;
     size_t connectionIndex;
 
-    int lookupErr = relayClientFindListenerAndConnection(self, packetFromServerToClient.connectionId, &listener,
-                                                         &connectionIndex);
+    int lookupErr = relayClientFindListenerAndConnection(self, connectionId, &listener, &connectionIndex);
     if (lookupErr >= 0) {
         CLOG_C_VERBOSE(&self->log, "found listener %" PRIX64 " push packet to connection index %zu",
                        listener->listenerId, connectionIndex)
-        ssize_t octetsWritten = relayListenerPushPacket(listener, connectionIndex, inStream->p,
-                                                        packetFromServerToClient.packetOctetCount);
+        ref->connectionIndex = (uint16_t) connectionIndex;
+        listener->connections[connectionIndex].lastReceivedAt = self->now;
+        if (relayClientIsOverQuota(self, listener->queuedPacketCount, ref, &listener->dropStats)) {
+            listener->connections[connectionIndex].dropStats.droppedPacketCount++;
+            listener->connections[connectionIndex].dropStats.droppedOctetCount += ref->octetCount;
+            return 0;
+        }
+        ssize_t octetsWritten = relayListenerPushPacketRef(listener, ref);
         if (octetsWritten < 0) {
             return (int) octetsWritten;
         }
@@ -99,28 +139,118 @@ static int onIncomingPacket(RelayClient* self, FldInStream* inStream)
         return 0;
     }
 
-    RelayConnector* connector = relayClientFindConnector(self, packetFromServerToClient.connectionId);
+    RelayConnector* connector = relayClientFindConnector(self, connectionId);
     if (connector == 0) {
-        CLOG_C_NOTICE(&self->log, "could not find a destination for packet for connection id %" PRIX64 ", dropping it",
-                      packetFromServerToClient.connectionId)
         return -2;
     }
 
-    ssize_t octetsWritten = relayConnectorPushPacket(connector, inStream->p, packetFromServerToClient.packetOctetCount);
-    if (octetsWritten < 0) {
+    if (relayClientIsOverQuota(self, relayPacketQueueCount(&connector->inQueue), ref, &connector->dropStats)) {
+        return 0;
+    }
+
+    int pushErr = relayConnectorPushPacketRef(connector, ref);
+    if (pushErr < 0) {
         CLOG_C_SOFT_ERROR(&self->log, "could not push packet to connector. buffer full?")
-        return (int) octetsWritten;
+        return pushErr;
     }
 
-    CLOG_C_VERBOSE(&self->log, "found connector to push packet to. octet count: %hu",
-                   packetFromServerToClient.packetOctetCount)
+    CLOG_C_VERBOSE(&self->log, "found connector to push packet to. octet count: %hu", ref->octetCount)
 
     return 0;
 }
 
+/// Delivers the packets that arrived before the connection id was known
+static void relayClientReplayEarlyArrivals(RelayClient* self, RelaySerializeConnectionId connectionId)
+{
+    if (self->earlyArrivals.count == 0) {
+        return;
+    }
+
+    RelayPacketRef refs[RELAY_CLIENT_EARLY_ARRIVAL_REPLAY_BATCH_COUNT];
+    size_t takenCount;
+    do {
+        takenCount = relayEarlyArrivalsTake(&self->earlyArrivals, connectionId, refs,
+                                            RELAY_CLIENT_EARLY_ARRIVAL_REPLAY_BATCH_COUNT);
+        for (size_t i = 0; i < takenCount; ++i) {
+            if (relayClientDeliverPacket(self, connectionId, &refs[i]) == -2) {
+                relayClientReleaseSlot(self, refs[i].slotIndex);
+            }
+        }
+        if (takenCount > 0) {
+            CLOG_C_DEBUG(&self->log, "replayed %zu early packets for connection id %" PRIX64, takenCount,
+                         connectionId)
+        }
+    } while (takenCount == RELAY_CLIENT_EARLY_ARRIVAL_REPLAY_BATCH_COUNT);
+}
+
+/// Takes ownership of one reference to the slot that the datagram was received into.
+/// Leaves inStream after the packet payload, or at the end if the rest of the datagram can not be trusted.
+static int onIncomingPacket(RelayClient* self, FldInStream* inStream, RelayPacketSlotIndex slotIndex)
+{
+    RelaySerializeServerPacketFromServerToClient packetFromServerToClient;
+
+    int packetHeaderErr = relaySerializeClientInPacketFromServer(inStream, &packetFromServerToClient);
+    if (packetHeaderErr < 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "could not deserialize in packet header")
+        self->stats.deserializeErrorCount++;
+        relayClientReleaseSlot(self, slotIndex);
+        inStream->pos = inStream->size;
+        return packetHeaderErr;
+    }
+
+    if (packetFromServerToClient.packetOctetCount > inStream->size - inStream->pos) {
+        CLOG_C_SOFT_ERROR(&self->log, "packet octet count %hu is larger than the datagram",
+                          packetFromServerToClient.packetOctetCount)
+        self->stats.deserializeErrorCount++;
+        relayClientReleaseSlot(self, slotIndex);
+        inStream->pos = inStream->size;
+        return -3;
+    }
+
+    size_t payloadPos = inStream->pos;
+    inStream->p += packetFromServerToClient.packetOctetCount;
+    inStream->pos += packetFromServerToClient.packetOctetCount;
+
+    if (slotIndex == RELAY_PACKET_SLOT_NONE) {
+        CLOG_C_NOTICE(&self->log, "packet pool is exhausted, dropping packet for connection id %" PRIX64,
+                      packetFromServerToClient.connectionId)
+        self->stats.poolExhaustedDropCount++;
+        return -4;
+    }
+
+    RelayPacketRef ref;
+    ref.slotIndex = slotIndex;
+    ref.octetOffset = (uint16_t) payloadPos;
+    ref.octetCount = packetFromServerToClient.packetOctetCount;
+    ref.connectionIndex = 0;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    ref.receivedAtMs = (uint32_t) self->datagramReceivedAt;
+    ref.queuedAtMs = (uint32_t) monotonicTimeMsNow();
+#endif
+
+    int deliverErr = relayClientDeliverPacket(self, packetFromServerToClient.connectionId, &ref);
+    if (deliverErr != -2) {
+        return deliverErr;
+    }
+
+    // the connection request or connect response can still be on its way, since datagrams can be reordered
+    if (relayEarlyArrivalsHold(&self->earlyArrivals, &self->packetPool, packetFromServerToClient.connectionId, &ref,
+                               self->now)) {
+        CLOG_C_VERBOSE(&self->log, "holding packet for unknown connection id %" PRIX64,
+                       packetFromServerToClient.connectionId)
+        return 0;
+    }
+
+    CLOG_C_NOTICE(&self->log, "could not find a destination for packet for connection id %" PRIX64 ", dropping it",
+                  packetFromServerToClient.connectionId)
+    self->stats.unknownConnectionDropCount++;
+
+    return -2;
+}
+
 static RelayListener* relayClientFindListener(RelayClient* self, RelaySerializeListenerId listenerId)
 {
-    for (size_t i = 0; i < RELAY_CLIENT_LISTENER_CAPACITY; ++i) {
+    for (size_t i = 0; i < self->listenerCapacity; ++i) {
         if (self->listeners[i].listenerId == listenerId) {
             return &self->listeners[i];
         }
@@ -131,7 +261,7 @@ static RelayListener* relayClientFindListener(RelayClient* self, RelaySerializeL
 
 static RelayListener* relayClientFindFreeListener(RelayClient* self)
 {
-    for (size_t i = 0; i < RELAY_CLIENT_LISTENER_CAPACITY; ++i) {
+    for (size_t i = 0; i < self->listenerCapacity; ++i) {
         if (self->listeners[i].state == RelayListenerStateIdle) {
             return &self->listeners[i];
         }
@@ -142,7 +272,7 @@ static RelayListener* relayClientFindFreeListener(RelayClient* self)
 
 static RelayConnector* relayClientFindFreeConnector(RelayClient* self)
 {
-    for (size_t i = 0; i < RELAY_CLIENT_CONNECTION_CAPACITY; ++i) {
+    for (size_t i = 0; i < self->connectorCapacity; ++i) {
         if (self->connectors[i].state == RelayConnectorStateIdle) {
             return &self->connectors[i];
         }
@@ -151,36 +281,28 @@ static RelayConnector* relayClientFindFreeConnector(RelayClient* self)
     return 0;
 }
 
-static RelayListener* relayClientFindListenerByAppAndChannel(RelayClient* self, RelaySerializeApplicationId appId,
-                                                             RelaySerializeChannelId channelId,
-                                                             RelaySerializeRequestId requestId)
+/// The request stays pending until the response has been accepted by the listener
+static RelayListener* relayClientFindListenerUsingRequestId(RelayClient* self, RelaySerializeRequestId requestId)
 {
-    for (size_t i = 0; i < RELAY_CLIENT_LISTENER_CAPACITY; ++i) {
-        RelayListener* listener = &self->listeners[i];
-        if (listener->listenerId != 0) {
-            continue;
-        }
-        if (listener->applicationId == appId && listener->channelId == channelId) {
-            if (listener->requestId != requestId) {
-                CLOG_C_NOTICE(&self->log, "not answer to same requestedID, but accepting it anyway")
-            }
-            return listener;
-        }
+    int listenerIndex = relayPendingRequestsFind(&self->pendingRequests, requestId, RelayPendingRequestKindListen);
+    if (listenerIndex < 0) {
+        relayPendingRequestsIgnore(&self->pendingRequests);
+        return 0;
     }
-    return 0;
+
+    return &self->listeners[listenerIndex];
 }
 
-static RelayConnector* relayClientFindConnectorUsingRequestId(RelayClient* self,
-                                                              RelaySerializeRequestId connectorRequestId)
+/// The request stays pending until the response has been accepted by the connector
+static RelayConnector* relayClientFindConnectorUsingRequestId(RelayClient* self, RelaySerializeRequestId requestId)
 {
-    for (size_t i = 0; i < RELAY_CLIENT_CONNECTION_CAPACITY; ++i) {
-        RelayConnector* connector = &self->connectors[i];
-        if (connector->requestId == connectorRequestId) {
-            return connector;
-        }
+    int connectorIndex = relayPendingRequestsFind(&self->pendingRequests, requestId, RelayPendingRequestKindConnect);
+    if (connectorIndex < 0) {
+        relayPendingRequestsIgnore(&self->pendingRequests);
+        return 0;
     }
 
-    return 0;
+    return &self->connectors[connectorIndex];
 }
 
 static int onConnectorResponse(RelayClient* self, FldInStream* inStream)
@@ -193,17 +315,35 @@ static int onConnectorResponse(RelayClient* self, FldInStream* inStream)
 
     RelayConnector* connector = relayClientFindConnectorUsingRequestId(self, data.requestId);
     if (connector == 0) {
-        CLOG_C_SOFT_ERROR(&self->log, "strange, got connect response for an unknown connector")
-        return -6;
+        // the relay server answers every attempt of a handshake, so this is usually a duplicate
+        CLOG_C_DEBUG(&self->log, "ignoring connect response for request %hhu that is not pending", data.requestId)
+        return 0;
     }
 
-    if (connector->state == RelayConnectorStateConnecting) {
-        CLOG_C_DEBUG(&self->log, "connector is connected to the relay server on connection id %" PRIX64 " request:%hhu",
-                     data.assignedConnectionId, data.requestId)
-        connector->state = RelayConnectorStateConnected;
-        connector->connectionId = data.assignedConnectionId;
+    size_t connectorIndex = (size_t) (connector - self->connectors);
+    if (connector->state != RelayConnectorStateConnecting) {
+        relayPendingRequestsRemove(&self->pendingRequests, data.requestId, RelayPendingRequestKindConnect,
+                                   connectorIndex);
+        return 0;
     }
 
+    relayPendingRequestsAnswer(&self->pendingRequests, data.requestId, RelayPendingRequestKindConnect, connectorIndex);
+
+    CLOG_C_DEBUG(&self->log, "connector is connected to the relay server on connection id %" PRIX64 " request:%hhu",
+                 data.assignedConnectionId, data.requestId)
+    relayRoutesRemove(&self->routes, connector->connectionId);
+    connector->state = RelayConnectorStateConnected;
+    connector->connectionId = data.assignedConnectionId;
+    relayPacketHeaderInit(&connector->header, connector->userSessionId, connector->connectionId);
+    if (relayRoutesInsert(&self->routes, connector->connectionId, RelayRouteKindConnector, connectorIndex, 0) < 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "could not add route for connection id %" PRIX64, connector->connectionId)
+        relayConnectorAbortHandshake(connector, RELAY_HANDSHAKE_ERR_REJECTED, RelayHandshakeResultRejected);
+        return -7;
+    }
+    relayClientReplayEarlyArrivals(self, connector->connectionId);
+    relayConnectorFlushPreConnectQueue(connector);
+    relayHandshakeCompletionDeliver(&connector->completion, RelayHandshakeResultSucceeded);
+
     return 0;
 }
 
@@ -215,15 +355,31 @@ static int onListenResponse(RelayClient* self, FldInStream* inStream)
         return err;
     }
 
-    RelayListener* listener = relayClientFindListenerByAppAndChannel(self, data.appId, data.channelId, data.requestId);
+    RelayListener* listener = relayClientFindListenerUsingRequestId(self, data.requestId);
     if (listener == 0) {
-        CLOG_C_SOFT_ERROR(&self->log, "got listen response, but I have no listener waiting for that")
+        CLOG_C_DEBUG(&self->log, "ignoring listen response for request %hhu that is not pending", data.requestId)
+        return 0;
+    }
+
+    size_t listenerIndex = (size_t) (listener - self->listeners);
+    if (listener->state != RelayListenerStateConnecting) {
+        relayPendingRequestsRemove(&self->pendingRequests, data.requestId, RelayPendingRequestKindListen,
+                                   listenerIndex);
+        return 0;
+    }
+
+    if (listener->applicationId != data.appId || listener->channelId != data.channelId) {
+        // the request stays pending, so a matching response to a retry is still accepted
+        CLOG_C_SOFT_ERROR(&self->log, "listen response for request %hhu does not match the listener", data.requestId)
+        relayPendingRequestsIgnore(&self->pendingRequests);
         return -5;
     }
 
+    relayPendingRequestsAnswer(&self->pendingRequests, data.requestId, RelayPendingRequestKindListen, listenerIndex);
     listener->listenerId = data.listenerId;
     listener->state = RelayListenerStateConnected;
     CLOG_C_DEBUG(&self->log, "listener connected to relay %" PRIX64, listener->listenerId)
+    relayHandshakeCompletionDeliver(&listener->completion, RelayHandshakeResultSucceeded);
 
     return 0;
 }
@@ -253,51 +409,246 @@ static int onConnectionRequestToListener(RelayClient* self, FldInStream* inStrea
             CLOG_C_SOFT_ERROR(&self->log, "out of connection capacity")
             return -4;
         }
-        connection = &listener->connections[foundIndex];
-        connection->connectionId = data.connectionId;
+        relayListenerAddConnection(listener, (size_t) foundIndex, data.connectionId, self->now);
+        if (self->connectionIdleTimeoutMs > 0 && self->now + self->connectionIdleTimeoutMs < self->nextIdleCheckAt) {
+            self->nextIdleCheckAt = self->now + self->connectionIdleTimeoutMs;
+        }
+        size_t listenerIndex = (size_t) (listener - self->listeners);
+        if (relayRoutesInsert(&self->routes, data.connectionId, RelayRouteKindListener, listenerIndex,
+                              (size_t) foundIndex) < 0) {
+            CLOG_C_SOFT_ERROR(&self->log, "could not add route for connection id %" PRIX64, data.connectionId)
+            relayListenerRemoveConnection(listener, (size_t) foundIndex);
+            return -7;
+        }
         CLOG_C_DEBUG(&self->log, "connection id %" PRIX64 " established on listener at index %zd", data.connectionId,
                      foundIndex)
+        relayClientReplayEarlyArrivals(self, data.connectionId);
     }
 
     return 0;
 }
 
-static int relayClientFeed(RelayClient* self, const uint8_t* data, size_t len)
+/// Handles a datagram from the relay server that was received into slotIndex (or RELAY_PACKET_SLOT_NONE).
+/// The datagram can hold several coalesced messages. Every packet in it is handed a reference to the slot,
+/// the reference of the datagram itself is released when all messages are handled.
+static int relayClientFeed(RelayClient* self, RelayPacketSlotIndex slotIndex, const uint8_t* data, size_t len)
 {
+    self->stats.datagramsReceived++;
+    self->stats.octetsReceived += len;
+
     FldInStream inStream;
     fldInStreamInit(&inStream, data, len);
 
-    uint8_t cmd;
-    fldInStreamReadUInt8(&inStream, &cmd);
-    CLOG_C_VERBOSE(&self->log, "received command: %s", relaySerializeCmdToString(cmd))
-    switch (cmd) {
-        case relaySerializeCmdPacketToClient:
-            return onIncomingPacket(self, &inStream);
-        case relaySerializeCmdConnectionRequestToClient:
-            return onConnectionRequestToListener(self, &inStream);
-        case relaySerializeCmdListenResponseToClient:
-            return onListenResponse(self, &inStream);
-        case relaySerializeCmdConnectResponseToClient:
-            return onConnectorResponse(self, &inStream);
-        default:
-            CLOG_C_ERROR(&self->log, "relayClientFeed: unknown message %02X", cmd)
-            // return -1;
+    int result = 0;
+    while (inStream.pos < inStream.size) {
+        uint8_t cmd;
+        fldInStreamReadUInt8(&inStream, &cmd);
+        CLOG_C_VERBOSE(&self->log, "received command: %s", relaySerializeCmdToString(cmd))
+
+        int messageResult = 0;
+        switch (cmd) {
+            case relaySerializeCmdPacketToClient:
+                relayClientRetainSlot(self, slotIndex);
+                messageResult = onIncomingPacket(self, &inStream, slotIndex);
+                break;
+            case relaySerializeCmdConnectionRequestToClient:
+                messageResult = onConnectionRequestToListener(self, &inStream);
+                break;
+            case relaySerializeCmdListenResponseToClient:
+                messageResult = onListenResponse(self, &inStream);
+                break;
+            case relaySerializeCmdConnectResponseToClient:
+                messageResult = onConnectorResponse(self, &inStream);
+                break;
+            default:
+                CLOG_C_ERROR(&self->log, "relayClientFeed: unknown message %02X", cmd)
+                self->stats.deserializeErrorCount++;
+                // the length of an unknown message is not known, so the rest of the datagram is skipped
+                inStream.pos = inStream.size;
+                break;
+        }
+
+        if (messageResult < 0) {
+            result = messageResult;
+            // the handler may have stopped in the middle of its message, so the next one can not be found
+            inStream.pos = inStream.size;
+        }
     }
+
+    relayClientReleaseSlot(self, slotIndex);
+
+    return result;
 }
 
-static int relayClientReceiveAllDatagramsFromRelayServer(RelayClient* self)
+/// Receives directly into packet pool slots. When the pool is exhausted a single datagram is received into
+/// receiveBuf, so handshakes keep working while the packets themselves are dropped. The caller keeps
+/// calling until the transport is drained or the budget is spent, so the socket buffer does not overflow.
+/// @return number of datagrams received, the first preparedCount entries of receiveSlots are owned by the caller
+static ssize_t relayClientReceiveBatch(RelayClient* self, size_t maxCount, size_t* preparedCount)
 {
+    RelayDatagram* datagrams = self->receiveDatagrams;
+
     size_t count = 0;
-    for (size_t i = 0; i < 30; ++i) {
-        ssize_t octetCount = datagramTransportReceive(&self->transportToRelayServer, self->receiveBuf,
+    for (; count < maxCount; ++count) {
+        if (relayPacketPoolAlloc(&self->packetPool, &self->receiveSlots[count]) < 0) {
+            break;
+        }
+        datagrams[count].octets = relayPacketPoolSlotOctets(&self->packetPool, self->receiveSlots[count]);
+        datagrams[count].octetCount = 0;
+    }
+
+    if (count == 0) {
+        self->receiveSlots[0] = RELAY_PACKET_SLOT_NONE;
+        datagrams[0].octets = self->receiveBuf;
+        datagrams[0].octetCount = 0;
+        count = 1;
+    }
+
+    *preparedCount = count;
+    maxCount = count;
+
+    const RelayTransportHooks* hooks = &self->socket.hooks;
+    if (hooks->receiveMany != 0) {
+        return hooks->receiveMany(hooks->self, datagrams, maxCount);
+    }
+
+    count = 0;
+    for (; count < maxCount; ++count) {
+        ssize_t octetCount = datagramTransportReceive(&self->socket.transport, datagrams[count].octets,
                                                       DATAGRAM_TRANSPORT_MAX_SIZE);
-        if (octetCount > 0) {
-            relayClientFeed(self, self->receiveBuf, (size_t) octetCount);
-            count++;
-        } else if (octetCount < 0) {
-            CLOG_C_SOFT_ERROR(&self->log, "error: %zd", octetCount)
-            return (int) octetCount;
+        if (octetCount < 0) {
+            if (count > 0) {
+                // handle what we got, the error will be reported on the next receive
+                break;
+            }
+            return octetCount;
+        }
+        if (octetCount == 0) {
+            break;
+        }
+        datagrams[count].octetCount = (size_t) octetCount;
+    }
+
+    return (ssize_t) count;
+}
+
+#if defined RELAY_CLIENT_THREADED
+/// Lends empty packet pool slots to the I/O thread, so it has somewhere to receive into
+static void relayClientLendSlotsToIoThread(RelayClient* self)
+{
+    RelaySpscRing* freeSlots = &self->ioThread.freeSlots;
+    size_t count = self->ioThread.slotCount - self->ioThreadLentSlotCount;
+    size_t available = relaySpscRingProducerAvailable(freeSlots);
+    if (count > available) {
+        count = available;
+    }
+
+    size_t lentCount = 0;
+    for (; lentCount < count; ++lentCount) {
+        RelayIoSlot* slot = relaySpscRingProducerItem(freeSlots, lentCount);
+        if (relayPacketPoolAlloc(&self->packetPool, &slot->slotIndex) < 0) {
+            break;
+        }
+        slot->octets = relayPacketPoolSlotOctets(&self->packetPool, slot->slotIndex);
+        slot->octetCount = 0;
+    }
+
+    relaySpscRingProducerCommit(freeSlots, lentCount);
+    self->ioThreadLentSlotCount += lentCount;
+    if (lentCount > 0) {
+        relayIoThreadWake(&self->ioThread);
+    }
+}
+
+/// Feeds the datagrams that the I/O thread has received since the last update
+static int relayClientReceiveFromIoThread(RelayClient* self)
+{
+    RelaySpscRing* receivedSlots = &self->ioThread.receivedSlots;
+    size_t count = relaySpscRingConsumerAvailable(receivedSlots);
+    if (count > self->receiveBudget.maxDatagramCount) {
+        count = self->receiveBudget.maxDatagramCount;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const RelayIoSlot* slot = relaySpscRingConsumerItem(receivedSlots, i);
+        if (slot->octetCount > 0) {
+#if defined RELAY_CLIENT_LATENCY_TRACING
+            self->datagramReceivedAt = slot->receivedAt;
+#endif
+            relayClientFeed(self, slot->slotIndex, slot->octets, slot->octetCount);
         } else {
+            relayClientReleaseSlot(self, slot->slotIndex);
+        }
+    }
+
+    relaySpscRingConsumerRelease(receivedSlots, count);
+    self->ioThreadLentSlotCount -= count;
+
+    relayClientLendSlotsToIoThread(self);
+    if (count > 0) {
+        // there is room in the received ring again
+        relayIoThreadWake(&self->ioThread);
+    }
+
+    return (int) count;
+}
+#endif
+
+static int relayClientReceiveAllDatagramsFromRelayServer(RelayClient* self)
+{
+#if defined RELAY_CLIENT_THREADED
+    if (self->useIoThread) {
+        return relayClientReceiveFromIoThread(self);
+    }
+#endif
+
+    MonotonicTimeMs startedAt = 0;
+    if (self->receiveBudget.maxDurationMs > 0) {
+        startedAt = monotonicTimeMsNow();
+    }
+
+    size_t count = 0;
+    while (count < self->receiveBudget.maxDatagramCount) {
+        size_t wantedCount = self->receiveBudget.maxDatagramCount - count;
+        if (wantedCount > RELAY_CLIENT_RECEIVE_BATCH_COUNT) {
+            wantedCount = RELAY_CLIENT_RECEIVE_BATCH_COUNT;
+        }
+
+        size_t preparedCount;
+        ssize_t receivedCount = relayClientReceiveBatch(self, wantedCount, &preparedCount);
+        size_t feedCount = receivedCount > 0 ? (size_t) receivedCount : 0;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+        self->datagramReceivedAt = monotonicTimeMsNow();
+#endif
+
+        for (size_t i = 0; i < feedCount; ++i) {
+            const RelayDatagram* datagram = &self->receiveDatagrams[i];
+            if (datagram->octetCount > 0) {
+                relayClientFeed(self, self->receiveSlots[i], datagram->octets, datagram->octetCount);
+            } else {
+                relayClientReleaseSlot(self, self->receiveSlots[i]);
+            }
+        }
+
+        for (size_t i = feedCount; i < preparedCount; ++i) {
+            relayClientReleaseSlot(self, self->receiveSlots[i]);
+        }
+
+        if (receivedCount < 0) {
+            CLOG_C_SOFT_ERROR(&self->log, "error: %zd", receivedCount)
+            return (int) receivedCount;
+        }
+
+        count += (size_t) receivedCount;
+
+        // fewer slots than wanted can be prepared when the pool runs low, that is not a reason to stop
+        if ((size_t) receivedCount < preparedCount) {
+            break;
+        }
+
+        if (self->receiveBudget.maxDurationMs > 0 &&
+            monotonicTimeMsNow() - startedAt >= self->receiveBudget.maxDurationMs) {
+            CLOG_C_VERBOSE(&self->log, "receive time budget exhausted after %zu datagrams", count)
             break;
         }
     }
@@ -305,32 +656,137 @@ static int relayClientReceiveAllDatagramsFromRelayServer(RelayClient* self)
     return (int) count;
 }
 
-int relayClientInit(RelayClient* self, RelaySerializeUserSessionId authenticatedUserSessionId,
-                    DatagramTransport transportToRelayServer, struct ImprintAllocator* memory, const char* prefix,
-                    Clog log)
+void relayClientSetupDefaults(RelayClientSetup* setup)
+{
+    setup->listenerCapacity = RELAY_CLIENT_LISTENER_CAPACITY;
+    setup->connectorCapacity = RELAY_CLIENT_CONNECTION_CAPACITY;
+    setup->maxConnectionsPerListener = RELAY_CLIENT_MAX_LISTENER_CONNECTIONS_COUNT;
+    setup->listenerConnectionQueueCapacity = RELAY_LISTENER_CONNECTION_QUEUE_CAPACITY;
+    setup->packetPoolSlotCount = RELAY_PACKET_POOL_DEFAULT_SLOT_COUNT;
+    relayRetrySetupDefaults(&setup->handshakeRetry);
+    setup->connectionIdleTimeoutMs = RELAY_CLIENT_DEFAULT_CONNECTION_IDLE_TIMEOUT_MS;
+    setup->endpointPacketQuota = RELAY_CLIENT_DEFAULT_ENDPOINT_PACKET_QUOTA;
+    setup->earlyArrivalCapacity = RELAY_EARLY_ARRIVAL_DEFAULT_CAPACITY;
+    setup->earlyArrivalHoldTimeMs = RELAY_EARLY_ARRIVAL_DEFAULT_HOLD_TIME_MS;
+}
+
+/// Initializes the client with capacities from the setup. All arrays are allocated from setup->memory,
+/// and only the configured number of listeners, connectors and connections are iterated.
+int relayClientInitWithSetup(RelayClient* self, const RelayClientSetup* setup)
 {
     char temp[32];
 
-    (void) prefix;
+    CLOG_ASSERT(setup->maxConnectionsPerListener <= RELAY_LISTENER_MAX_CONNECTION_CAPACITY,
+                "a listener can have at most %d connections", RELAY_LISTENER_MAX_CONNECTION_CAPACITY)
+    CLOG_ASSERT(setup->listenerConnectionQueueCapacity != 0 &&
+                    (setup->listenerConnectionQueueCapacity & (setup->listenerConnectionQueueCapacity - 1)) == 0,
+                "listener connection queue capacity must be a power of two")
 
-    for (size_t i = 0; i < RELAY_CLIENT_LISTENER_CAPACITY; ++i) {
+    self->log = setup->log;
+
+    relayPacketPoolInit(&self->packetPool, setup->memory, setup->packetPoolSlotCount);
+    relayBufferPoolInit(&self->listenerBufferPool, setup->memory,
+                        relayListenerBufferOctetCount(setup->maxConnectionsPerListener,
+                                                      setup->listenerConnectionQueueCapacity));
+    relayBufferPoolInit(&self->connectorBufferPool, setup->memory, relayConnectorBufferOctetCount());
+
+    self->listenerCapacity = setup->listenerCapacity;
+    self->listeners = IMPRINT_ALLOC_TYPE_COUNT(setup->memory, RelayListener, self->listenerCapacity);
+    for (size_t i = 0; i < self->listenerCapacity; ++i) {
         tc_snprintf(temp, 32, "listener-%zu", i);
-        relayListenerInit(&self->listeners[i], memory, temp, log);
+        relayListenerInit(&self->listeners[i], &self->packetPool, &self->listenerBufferPool,
+                          setup->maxConnectionsPerListener, setup->listenerConnectionQueueCapacity, temp,
+                          setup->log);
     }
 
-    for (size_t i = 0; i < RELAY_CLIENT_CONNECTION_CAPACITY; ++i) {
+    self->connectorCapacity = setup->connectorCapacity;
+    self->connectors = IMPRINT_ALLOC_TYPE_COUNT(setup->memory, RelayConnector, self->connectorCapacity);
+    for (size_t i = 0; i < self->connectorCapacity; ++i) {
         tc_snprintf(temp, 32, "connector-%zu", i);
-        relayConnectorInit(&self->connectors[i], memory, log);
+        relayConnectorInit(&self->connectors[i], &self->packetPool, &self->connectorBufferPool, setup->log);
     }
 
-    self->userSessionId = authenticatedUserSessionId;
-    CLOG_ASSERT(authenticatedUserSessionId != 0, "user session id can not be zero")
-    self->transportToRelayServer = transportToRelayServer;
-    self->log = log;
+    relayRoutesInit(&self->routes, setup->memory,
+                    self->listenerCapacity * setup->maxConnectionsPerListener + self->connectorCapacity);
+    relayEarlyArrivalsInit(&self->earlyArrivals, setup->memory, setup->earlyArrivalCapacity,
+                           setup->earlyArrivalHoldTimeMs);
+    relayPendingRequestsInit(&self->pendingRequests);
+
+    self->userSessionId = setup->authenticatedUserSessionId;
+    CLOG_ASSERT(self->userSessionId != 0, "user session id can not be zero")
+    relaySocketInit(&self->socket, setup->transportToRelayServer, setup->memory, setup->log);
+    self->receiveBudget.maxDatagramCount = RELAY_CLIENT_DEFAULT_RECEIVE_MAX_DATAGRAM_COUNT;
+    self->receiveBudget.maxDurationMs = 0;
+    self->handshakeRetry = setup->handshakeRetry;
+    self->connectionIdleTimeoutMs = setup->connectionIdleTimeoutMs;
+    self->endpointPacketQuota = setup->endpointPacketQuota;
+    self->now = 0;
+    self->nextIdleCheckAt = RELAY_CLIENT_NO_DEADLINE;
+    tc_mem_clear_type(&self->stats);
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    self->datagramReceivedAt = 0;
+#endif
+#if defined RELAY_CLIENT_THREADED
+    self->ioThread.isInitialized = false;
+    self->useIoThread = false;
+    self->ioThreadLentSlotCount = 0;
+#endif
 
     return 0;
 }
 
+int relayClientInit(RelayClient* self, RelaySerializeUserSessionId authenticatedUserSessionId,
+                    DatagramTransport transportToRelayServer, struct ImprintAllocator* memory, const char* prefix,
+                    Clog log)
+{
+    (void) prefix;
+
+    RelayClientSetup setup;
+    relayClientSetupDefaults(&setup);
+    setup.authenticatedUserSessionId = authenticatedUserSessionId;
+    setup.transportToRelayServer = transportToRelayServer;
+    setup.memory = memory;
+    setup.log = log;
+
+    return relayClientInitWithSetup(self, &setup);
+}
+
+/// Sets optional batch functions for the transport to the relay server.
+/// The hooks must operate on the same socket as the transport given in relayClientInit().
+void relayClientSetTransportHooks(RelayClient* self, RelayTransportHooks hooks)
+{
+    self->socket.hooks = hooks;
+}
+
+/// Limits how much is drained from the transport in each relayClientUpdate()
+/// @param maxDatagramCount maximum number of datagrams to handle in one update
+/// @param maxDurationMs stop draining after this many milliseconds, zero means no time limit
+void relayClientSetReceiveBudget(RelayClient* self, size_t maxDatagramCount, MonotonicTimeMs maxDurationMs)
+{
+    CLOG_ASSERT(maxDatagramCount > 0, "must be able to receive at least one datagram each update")
+    self->receiveBudget.maxDatagramCount = maxDatagramCount;
+    self->receiveBudget.maxDurationMs = maxDurationMs;
+}
+
+/// In queued mode all datagrams to the relay server are collected and sent in one batch at the end of
+/// relayClientUpdate() or on relayClientFlush(), instead of one transport send for each packet.
+void relayClientSetSendQueueEnabled(RelayClient* self, bool enabled)
+{
+    relaySocketSetOutQueueEnabled(&self->socket, enabled);
+}
+
+/// Packs packets that are sent before the next flush into as few datagrams as possible. Enables the send queue.
+/// The relay server must accept several packet messages in one datagram.
+void relayClientSetCoalescingEnabled(RelayClient* self, bool enabled)
+{
+    relaySocketSetCoalescingEnabled(&self->socket, enabled);
+}
+
+int relayClientFlush(RelayClient* self)
+{
+    return relaySocketFlush(&self->socket);
+}
+
 RelayListener* relayClientStartListen(RelayClient* self, RelaySerializeApplicationId applicationId,
                                       RelaySerializeChannelId channelId)
 {
@@ -339,12 +795,23 @@ RelayListener* relayClientStartListen(RelayClient* self, RelaySerializeApplicati
         return 0;
     }
 
+    size_t listenerIndex = (size_t) (listener - self->listeners);
+    // a listener that was disconnected directly can still hold its previous request id
+    relayPendingRequestsRemove(&self->pendingRequests, listener->requestId, RelayPendingRequestKindListen,
+                               listenerIndex);
+
     RelayListenerSetup setup;
+    if (relayPendingRequestsAdd(&self->pendingRequests, RelayPendingRequestKindListen, listenerIndex,
+                                &setup.requestId) < 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "startListen: every request id is in use")
+        return 0;
+    }
 
     setup.channelId = channelId;
     setup.applicationId = applicationId;
-    setup.transportToRelayServer = self->transportToRelayServer;
+    setup.socket = &self->socket;
     setup.authenticatedUserSessionId = self->userSessionId;
+    setup.retry = self->handshakeRetry;
     relayListenerReInit(listener, &setup);
 
     return listener;
@@ -359,17 +826,89 @@ RelayConnector* relayClientStartConnect(RelayClient* self, RelaySerializeUserId
         return 0;
     }
 
-    relayConnectorReInit(connector, &self->transportToRelayServer, self->userSessionId, userId, applicationId,
-                         channelId);
+    size_t connectorIndex = (size_t) (connector - self->connectors);
+    relayPendingRequestsRemove(&self->pendingRequests, connector->requestId, RelayPendingRequestKindConnect,
+                               connectorIndex);
+
+    RelaySerializeRequestId requestId;
+    if (relayPendingRequestsAdd(&self->pendingRequests, RelayPendingRequestKindConnect, connectorIndex, &requestId) <
+        0) {
+        CLOG_C_SOFT_ERROR(&self->log, "startConnect: every request id is in use")
+        return 0;
+    }
+
+    relayRoutesRemove(&self->routes, connector->connectionId);
+
+    relayConnectorReInit(connector, &self->socket, self->userSessionId, userId, applicationId, channelId, requestId,
+                         &self->handshakeRetry);
 
     CLOG_C_DEBUG(&self->log, "startConnect: user sessionID %" PRIX64 " to userId:%" PRIX64, self->userSessionId, userId)
 
     return connector;
 }
 
-int relayClientUpdate(RelayClient* self, MonotonicTimeMs now)
+/// Stops listening and returns the listener buffers to the client
+void relayClientStopListen(RelayClient* self, RelayListener* listener)
+{
+    if (listener->connections != 0) {
+        for (size_t i = 0; i < listener->connectionCapacity; ++i) {
+            relayRoutesRemove(&self->routes, listener->connections[i].connectionId);
+        }
+    }
+
+    relayPendingRequestsRemove(&self->pendingRequests, listener->requestId, RelayPendingRequestKindListen,
+                               (size_t) (listener - self->listeners));
+    relayListenerDisconnect(listener);
+}
+
+/// Disconnects the connector and returns its buffers to the client
+void relayClientStopConnect(RelayClient* self, RelayConnector* connector)
+{
+    relayRoutesRemove(&self->routes, connector->connectionId);
+    relayPendingRequestsRemove(&self->pendingRequests, connector->requestId, RelayPendingRequestKindConnect,
+                               (size_t) (connector - self->connectors));
+    relayConnectorDisconnect(connector);
+}
+
+/// Removes listener connections that the relay server has not delivered anything on for a while,
+/// and remembers when the next remaining connection can become idle
+static void relayClientRemoveIdleConnections(RelayClient* self, MonotonicTimeMs now)
+{
+    MonotonicTimeMs nextCheckAt = RELAY_CLIENT_NO_DEADLINE;
+
+    for (size_t listenerIndex = 0; listenerIndex < self->listenerCapacity; ++listenerIndex) {
+        RelayListener* listener = &self->listeners[listenerIndex];
+        if (listener->state != RelayListenerStateConnected || listener->connections == 0) {
+            continue;
+        }
+
+        for (size_t i = 0; i < listener->connectionCapacity; ++i) {
+            RelayConnection* connection = &listener->connections[i];
+            if (connection->connectionId == 0) {
+                continue;
+            }
+
+            MonotonicTimeMs idleAt = connection->lastReceivedAt + self->connectionIdleTimeoutMs;
+            if (now < idleAt) {
+                if (idleAt < nextCheckAt) {
+                    nextCheckAt = idleAt;
+                }
+                continue;
+            }
+
+            CLOG_C_DEBUG(&self->log, "removing idle connection id %" PRIX64 " on listener %zu index %zu",
+                         connection->connectionId, listenerIndex, i)
+            relayRoutesRemove(&self->routes, connection->connectionId);
+            relayListenerRemoveConnection(listener, i);
+        }
+    }
+
+    self->nextIdleCheckAt = nextCheckAt;
+}
+
+static int relayClientUpdateAll(RelayClient* self, MonotonicTimeMs now)
 {
-    (void) now;
+    self->now = now;
 
     // CLOG_C_VERBOSE(&self->log, "read all datagrams from relay server")
 
@@ -378,19 +917,190 @@ int relayClientUpdate(RelayClient* self, MonotonicTimeMs now)
         return receiveErr;
     }
 
-    for (size_t i = 0; i < RELAY_CLIENT_LISTENER_CAPACITY; ++i) {
+    for (size_t i = 0; i < self->listenerCapacity; ++i) {
         RelayListener* listener = &self->listeners[i];
         if (listener->state == RelayListenerStateConnecting) {
-            relayListenerUpdate(listener, now);
+            int updateErr = relayListenerUpdate(listener, now);
+            if (updateErr < 0) {
+                CLOG_C_NOTICE(&self->log, "listener %zu update failed: %d", i, updateErr)
+            }
+            if (listener->state != RelayListenerStateConnecting) {
+                relayPendingRequestsExpire(&self->pendingRequests, listener->requestId, RelayPendingRequestKindListen,
+                                           i);
+            }
         }
     }
 
-    for (size_t connectorIndex = 0; connectorIndex < RELAY_CLIENT_CONNECTION_CAPACITY; ++connectorIndex) {
+    for (size_t connectorIndex = 0; connectorIndex < self->connectorCapacity; ++connectorIndex) {
         RelayConnector* connector = &self->connectors[connectorIndex];
         if (connector->state == RelayConnectorStateConnecting) {
-            relayConnectorUpdate(connector, now);
+            int updateErr = relayConnectorUpdate(connector, now);
+            if (updateErr < 0) {
+                CLOG_C_NOTICE(&self->log, "connector %zu update failed: %d", connectorIndex, updateErr)
+            }
+            if (connector->state != RelayConnectorStateConnecting) {
+                relayPendingRequestsExpire(&self->pendingRequests, connector->requestId,
+                                           RelayPendingRequestKindConnect, connectorIndex);
+            }
         }
     }
 
+    if (now >= self->nextIdleCheckAt) {
+        relayClientRemoveIdleConnections(self, now);
+    }
+
+    if (self->earlyArrivals.count > 0) {
+        relayEarlyArrivalsExpire(&self->earlyArrivals, &self->packetPool, now);
+    }
+
+    return relaySocketFlush(&self->socket);
+}
+
+int relayClientUpdate(RelayClient* self, MonotonicTimeMs now)
+{
+    RelayMicroseconds startedAt = relayMicrosecondClockNow();
+    int result = relayClientUpdateAll(self, now);
+    RelayMicroseconds duration = relayMicrosecondClockNow() - startedAt;
+
+    self->stats.updateCount++;
+    self->stats.lastUpdateDurationUs = duration;
+    self->stats.totalUpdateDurationUs += duration;
+    if (duration > self->stats.maxUpdateDurationUs) {
+        self->stats.maxUpdateDurationUs = duration;
+    }
+
+    return result;
+}
+
+/// A file descriptor that becomes readable when datagrams arrive from the relay server, so the caller can sleep
+/// in epoll/poll until there is something to receive. Requires the pollFd transport hook.
+/// @return the file descriptor, or negative if the transport does not have one
+int relayClientPollFd(const RelayClient* self)
+{
+#if defined RELAY_CLIENT_THREADED
+    if (self->useIoThread) {
+        return -1;
+    }
+#endif
+
+    const RelayTransportHooks* hooks = &self->socket.hooks;
+    if (hooks->pollFd == 0) {
+        return -1;
+    }
+
+    return hooks->pollFd(hooks->self);
+}
+
+/// The latest time relayClientUpdate() must be called, even if no datagram arrives before that.
+/// Covers handshake retries and idle connection timeouts.
+/// @return the deadline, or RELAY_CLIENT_NO_DEADLINE if the client only needs to be updated when datagrams arrive
+MonotonicTimeMs relayClientNextDeadline(const RelayClient* self)
+{
+    if (self->socket.outQueue.count > 0) {
+        return self->now;
+    }
+
+    MonotonicTimeMs deadline = self->nextIdleCheckAt;
+
+    if (self->earlyArrivals.count > 0 && self->earlyArrivals.entries[0].expiresAt < deadline) {
+        deadline = self->earlyArrivals.entries[0].expiresAt;
+    }
+
+    for (size_t i = 0; i < self->listenerCapacity; ++i) {
+        const RelayListener* listener = &self->listeners[i];
+        if (listener->state != RelayListenerStateConnecting) {
+            continue;
+        }
+        MonotonicTimeMs retryAt = listener->retry.attemptCount == 0 ? self->now : listener->retry.nextAttemptAt;
+        if (retryAt < deadline) {
+            deadline = retryAt;
+        }
+    }
+
+    for (size_t i = 0; i < self->connectorCapacity; ++i) {
+        const RelayConnector* connector = &self->connectors[i];
+        if (connector->state != RelayConnectorStateConnecting) {
+            continue;
+        }
+        MonotonicTimeMs retryAt = connector->retry.attemptCount == 0 ? self->now : connector->retry.nextAttemptAt;
+        if (retryAt < deadline) {
+            deadline = retryAt;
+        }
+    }
+
+    return deadline;
+}
+
+#if defined RELAY_CLIENT_THREADED
+/// Moves all socket receives and sends to a separate thread, so datagrams keep flowing while the game thread
+/// is busy. relayClientUpdate() must still be called on the game thread to handle what has been received.
+/// @param slotCount the number of packet pool slots lent to the I/O thread, must be a power of two
+int relayClientStartIoThread(RelayClient* self, size_t slotCount)
+{
+    if (self->useIoThread) {
+        CLOG_C_SOFT_ERROR(&self->log, "io thread is already running")
+        return -1;
+    }
+
+    if (!self->ioThread.isInitialized) {
+        relayIoThreadInit(&self->ioThread, self->socket.memory, slotCount, self->log);
+    } else if (self->ioThread.slotCount != slotCount) {
+        CLOG_C_SOFT_ERROR(&self->log, "io thread slot count can not be changed once set")
+        return -2;
+    }
+
+    int err = relayIoThreadStart(&self->ioThread, self->socket.transport, self->socket.hooks);
+    if (err < 0) {
+        return err;
+    }
+
+    self->socket.transport = relayIoThreadTransport(&self->ioThread);
+    self->socket.hooks.sendMany = 0;
+    self->socket.hooks.receiveMany = 0;
+    self->useIoThread = true;
+    self->ioThreadLentSlotCount = 0;
+    relayClientLendSlotsToIoThread(self);
+
     return 0;
 }
+
+/// Stops the I/O thread and gives the transport back to the game thread. Datagrams that were already received
+/// are handled, and the lent slots are returned to the packet pool.
+void relayClientStopIoThread(RelayClient* self)
+{
+    if (!self->useIoThread) {
+        return;
+    }
+
+    relaySocketFlush(&self->socket);
+    relayIoThreadStop(&self->ioThread);
+
+    RelaySpscRing* receivedSlots = &self->ioThread.receivedSlots;
+    size_t receivedCount = relaySpscRingConsumerAvailable(receivedSlots);
+    for (size_t i = 0; i < receivedCount; ++i) {
+        const RelayIoSlot* slot = relaySpscRingConsumerItem(receivedSlots, i);
+        if (slot->octetCount > 0) {
+#if defined RELAY_CLIENT_LATENCY_TRACING
+            self->datagramReceivedAt = slot->receivedAt;
+#endif
+            relayClientFeed(self, slot->slotIndex, slot->octets, slot->octetCount);
+        } else {
+            relayClientReleaseSlot(self, slot->slotIndex);
+        }
+    }
+    relaySpscRingConsumerRelease(receivedSlots, receivedCount);
+
+    RelaySpscRing* freeSlots = &self->ioThread.freeSlots;
+    size_t freeCount = relaySpscRingConsumerAvailable(freeSlots);
+    for (size_t i = 0; i < freeCount; ++i) {
+        const RelayIoSlot* slot = relaySpscRingConsumerItem(freeSlots, i);
+        relayClientReleaseSlot(self, slot->slotIndex);
+    }
+    relaySpscRingConsumerRelease(freeSlots, freeCount);
+
+    self->socket.transport = self->ioThread.transport;
+    self->socket.hooks = self->ioThread.hooks;
+    self->ioThreadLentSlotCount = 0;
+    self->useIoThread = false;
+}
+#endif
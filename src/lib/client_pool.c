@@ -0,0 +1,561 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <imprint/allocator.h>
+#include <relay-client/client_pool.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <tiny-libc/tiny_libc.h>
+#include <unistd.h>
+
+void relayClientPoolSetupDefaults(RelayClientPoolSetup* setup)
+{
+    setup->workerCount = 1;
+    setup->firstCpuIndex = -1;
+    setup->updateIntervalMs = RELAY_CLIENT_POOL_DEFAULT_UPDATE_INTERVAL_MS;
+    setup->mailboxCapacity = RELAY_CLIENT_POOL_DEFAULT_MAILBOX_CAPACITY;
+}
+
+/// Allocates the clients and the workers. The clients must be initialized with relayClientInitWithSetup() on
+/// relayClientPoolClient() before the pool is started.
+int relayClientPoolInit(RelayClientPool* self, const RelayClientPoolSetup* setup)
+{
+    if (setup->workerCount == 0 || setup->workerCount > setup->clientCount) {
+        CLOG_SOFT_ERROR("relay client pool needs between one worker and one worker per client")
+        return -1;
+    }
+
+    self->log = setup->log;
+    self->clientCount = setup->clientCount;
+    self->workerCount = setup->workerCount;
+    self->updateIntervalMs = setup->updateIntervalMs;
+    self->memory = setup->memory;
+    self->isRunning = 0;
+
+    self->entries = IMPRINT_ALLOC_TYPE_COUNT(setup->memory, RelayClientPoolEntry, self->clientCount);
+    for (size_t i = 0; i < self->clientCount; ++i) {
+        RelayClientPoolEntry* entry = &self->entries[i];
+        relaySpscRingInit(&entry->toClient, setup->memory, sizeof(RelayClientPoolPacket), setup->mailboxCapacity);
+        relaySpscRingInit(&entry->fromClient, setup->memory, sizeof(RelayClientPoolPacket), setup->mailboxCapacity);
+        relaySpscRingInit(&entry->commands, setup->memory, sizeof(RelayClientPoolCommand),
+                          RELAY_CLIENT_POOL_COMMAND_CAPACITY);
+        entry->listenerContexts = 0;
+        entry->connectorContexts = 0;
+        entry->nextDeadline = 0;
+        entry->isPolled = false;
+        entry->droppedToClientCount = 0;
+        entry->droppedFromClientCount = 0;
+        entry->skippedToClientCount = 0;
+    }
+
+    self->workers = IMPRINT_ALLOC_TYPE_COUNT(setup->memory, RelayClientPoolWorker, self->workerCount);
+    size_t clientsPerWorker = self->clientCount / self->workerCount;
+    size_t remainder = self->clientCount % self->workerCount;
+    size_t firstClientIndex = 0;
+    for (size_t i = 0; i < self->workerCount; ++i) {
+        RelayClientPoolWorker* worker = &self->workers[i];
+        worker->pool = self;
+        worker->firstClientIndex = firstClientIndex;
+        worker->clientCount = clientsPerWorker + (i < remainder ? 1 : 0);
+        worker->epollFd = -1;
+        worker->cpuIndex = setup->firstCpuIndex < 0 ? -1 : setup->firstCpuIndex + (int) i;
+        firstClientIndex += worker->clientCount;
+    }
+
+    return 0;
+}
+
+/// Only allowed while the pool is stopped, the client is owned by its worker while running.
+/// Use relayClientPoolStartListen() and relayClientPoolStartConnect() to start endpoints on a running pool.
+RelayClient* relayClientPoolClient(RelayClientPool* self, size_t clientIndex)
+{
+    CLOG_ASSERT(!__atomic_load_n(&self->isRunning, __ATOMIC_ACQUIRE), "client pool is running")
+    return &self->entries[clientIndex].client;
+}
+
+/// The match thread can not see the endpoint state, so packets for endpoints that have been stopped, or were
+/// never started, are skipped here
+static bool relayClientPoolCanSend(const RelayClient* client, const RelayClientPoolPacket* packet)
+{
+    if (packet->endpointKind == RelayClientPoolEndpointListener) {
+        if (packet->endpointIndex >= client->listenerCapacity) {
+            return false;
+        }
+        const RelayListener* listener = &client->listeners[packet->endpointIndex];
+        return listener->state == RelayListenerStateConnected && listener->connections != 0 &&
+               packet->connectionIndex < listener->connectionCapacity;
+    }
+
+    return packet->endpointIndex < client->connectorCapacity &&
+           client->connectors[packet->endpointIndex].state != RelayConnectorStateIdle;
+}
+
+static void relayClientPoolSendFromMailbox(RelayClientPoolEntry* entry)
+{
+    RelayClient* client = &entry->client;
+    size_t count = relaySpscRingConsumerAvailable(&entry->toClient);
+
+    for (size_t i = 0; i < count; ++i) {
+        const RelayClientPoolPacket* packet = relaySpscRingConsumerItem(&entry->toClient, i);
+        if (!relayClientPoolCanSend(client, packet)) {
+            entry->skippedToClientCount++;
+            continue;
+        }
+
+        if (packet->endpointKind == RelayClientPoolEndpointListener) {
+            relayListenerSendToConnectionIndex(&client->listeners[packet->endpointIndex], packet->connectionIndex,
+                                               packet->octets, packet->octetCount);
+        } else {
+            relayConnectorSend(&client->connectors[packet->endpointIndex], packet->octets, packet->octetCount);
+        }
+    }
+
+    relaySpscRingConsumerRelease(&entry->toClient, count);
+}
+
+static void relayClientPoolPostToMailbox(RelayClientPoolEntry* entry, RelayClientPoolEndpointKind endpointKind,
+                                         size_t endpointIndex, const RelayReceivedPacket* received)
+{
+    if (relaySpscRingProducerAvailable(&entry->fromClient) == 0) {
+        entry->droppedFromClientCount++;
+        return;
+    }
+
+    RelayClientPoolPacket* packet = relaySpscRingProducerItem(&entry->fromClient, 0);
+    packet->kind = RelayClientPoolPacketData;
+    packet->endpointKind = (uint8_t) endpointKind;
+    packet->endpointIndex = (uint16_t) endpointIndex;
+    packet->connectionIndex = received->connectionIndex;
+    packet->octetCount = (uint16_t) received->octetCount;
+    tc_memcpy_octets(packet->octets, received->octets, received->octetCount);
+    relaySpscRingProducerCommit(&entry->fromClient, 1);
+}
+
+static void relayClientPoolPostHandshakeDone(RelayClientPoolEntry* entry, RelayClientPoolEndpointKind endpointKind,
+                                             size_t endpointIndex, uint32_t tag, RelayHandshakeResult result)
+{
+    if (relaySpscRingProducerAvailable(&entry->fromClient) == 0) {
+        entry->droppedFromClientCount++;
+        return;
+    }
+
+    RelayClientPoolPacket* packet = relaySpscRingProducerItem(&entry->fromClient, 0);
+    packet->kind = RelayClientPoolPacketHandshakeDone;
+    packet->endpointKind = (uint8_t) endpointKind;
+    packet->endpointIndex = (uint16_t) endpointIndex;
+    packet->connectionIndex = 0;
+    packet->handshakeResult = (uint8_t) result;
+    packet->tag = tag;
+    packet->octetCount = 0;
+    relaySpscRingProducerCommit(&entry->fromClient, 1);
+}
+
+static void relayClientPoolOnHandshakeDone(void* _context, RelayHandshakeResult result)
+{
+    const RelayClientPoolEndpointContext* context = (const RelayClientPoolEndpointContext*) _context;
+
+    relayClientPoolPostHandshakeDone(context->entry, (RelayClientPoolEndpointKind) context->endpointKind,
+                                     context->endpointIndex, context->tag, result);
+}
+
+static RelayHandshakeCompletion relayClientPoolEndpointCompletion(RelayClientPoolEndpointContext* context,
+                                                                  RelayClientPoolEntry* entry,
+                                                                  RelayClientPoolEndpointKind endpointKind,
+                                                                  size_t endpointIndex, uint32_t tag)
+{
+    context->entry = entry;
+    context->endpointKind = (uint8_t) endpointKind;
+    context->endpointIndex = (uint16_t) endpointIndex;
+    context->tag = tag;
+
+    RelayHandshakeCompletion completion;
+    completion.onDone = relayClientPoolOnHandshakeDone;
+    completion.userData = context;
+
+    return completion;
+}
+
+static void relayClientPoolRunCommand(RelayClientPoolEntry* entry, const RelayClientPoolCommand* command)
+{
+    RelayClient* client = &entry->client;
+
+    switch ((RelayClientPoolCommandKind) command->kind) {
+        case RelayClientPoolCommandStartListen: {
+            RelayListener* listener = relayClientStartListen(client, command->applicationId, command->channelId);
+            if (listener == 0) {
+                relayClientPoolPostHandshakeDone(entry, RelayClientPoolEndpointListener,
+                                                 RELAY_CLIENT_POOL_NO_ENDPOINT, command->tag,
+                                                 RelayHandshakeResultRejected);
+                break;
+            }
+            size_t index = (size_t) (listener - client->listeners);
+            relayListenerSetCompletion(listener,
+                                       relayClientPoolEndpointCompletion(&entry->listenerContexts[index], entry,
+                                                                         RelayClientPoolEndpointListener, index,
+                                                                         command->tag));
+        } break;
+        case RelayClientPoolCommandStartConnect: {
+            RelayConnector* connector = relayClientStartConnect(client, command->userId, command->applicationId,
+                                                                command->channelId);
+            if (connector == 0) {
+                relayClientPoolPostHandshakeDone(entry, RelayClientPoolEndpointConnector,
+                                                 RELAY_CLIENT_POOL_NO_ENDPOINT, command->tag,
+                                                 RelayHandshakeResultRejected);
+                break;
+            }
+            size_t index = (size_t) (connector - client->connectors);
+            relayConnectorSetCompletion(connector,
+                                        relayClientPoolEndpointCompletion(&entry->connectorContexts[index], entry,
+                                                                          RelayClientPoolEndpointConnector, index,
+                                                                          command->tag));
+        } break;
+        case RelayClientPoolCommandStopListen:
+            if (command->endpointIndex < client->listenerCapacity) {
+                relayClientStopListen(client, &client->listeners[command->endpointIndex]);
+            }
+            break;
+        case RelayClientPoolCommandStopConnect:
+            if (command->endpointIndex < client->connectorCapacity) {
+                relayClientStopConnect(client, &client->connectors[command->endpointIndex]);
+            }
+            break;
+    }
+}
+
+static void relayClientPoolRunCommands(RelayClientPoolEntry* entry)
+{
+    size_t count = relaySpscRingConsumerAvailable(&entry->commands);
+
+    for (size_t i = 0; i < count; ++i) {
+        relayClientPoolRunCommand(entry, relaySpscRingConsumerItem(&entry->commands, i));
+    }
+
+    relaySpscRingConsumerRelease(&entry->commands, count);
+}
+
+static void relayClientPoolCollectReceived(RelayClientPoolEntry* entry)
+{
+    RelayClient* client = &entry->client;
+    RelayReceivedPacket received;
+
+    for (size_t i = 0; i < client->listenerCapacity; ++i) {
+        RelayListener* listener = &client->listeners[i];
+        if (listener->connections == 0) {
+            continue;
+        }
+        while (relayListenerBorrowPacket(listener, &received)) {
+            relayClientPoolPostToMailbox(entry, RelayClientPoolEndpointListener, i, &received);
+            relayListenerReleasePacket(listener, &received);
+        }
+    }
+
+    for (size_t i = 0; i < client->connectorCapacity; ++i) {
+        RelayConnector* connector = &client->connectors[i];
+        if (connector->inQueue.refs == 0) {
+            continue;
+        }
+        while (relayConnectorBorrowPacket(connector, &received)) {
+            relayClientPoolPostToMailbox(entry, RelayClientPoolEndpointConnector, i, &received);
+            relayConnectorReleasePacket(connector, &received);
+        }
+    }
+}
+
+static void relayClientPoolServe(RelayClientPool* self, size_t clientIndex, MonotonicTimeMs now)
+{
+    RelayClientPoolEntry* entry = &self->entries[clientIndex];
+
+    relayClientPoolRunCommands(entry);
+    relayClientPoolSendFromMailbox(entry);
+    int updateErr = relayClientUpdate(&entry->client, now);
+    if (updateErr < 0) {
+        CLOG_C_NOTICE(&self->log, "client %zu update failed: %d", clientIndex, updateErr)
+    }
+    relayClientPoolCollectReceived(entry);
+
+    // a deadline that has already passed is retried on the next millisecond instead of spinning
+    MonotonicTimeMs nextDeadline = relayClientNextDeadline(&entry->client);
+    entry->nextDeadline = nextDeadline > now ? nextDeadline : now + 1;
+}
+
+static bool relayClientPoolHasMail(const RelayClientPoolEntry* entry)
+{
+    return relaySpscRingConsumerAvailable(&entry->toClient) > 0 ||
+           relaySpscRingConsumerAvailable(&entry->commands) > 0;
+}
+
+static void* relayClientPoolWorkerMain(void* _self)
+{
+    RelayClientPoolWorker* worker = (RelayClientPoolWorker*) _self;
+    RelayClientPool* self = worker->pool;
+    struct epoll_event events[RELAY_CLIENT_POOL_EPOLL_EVENT_COUNT];
+
+    MonotonicTimeMs nextMailCheckAt = 0;
+    while (__atomic_load_n(&self->isRunning, __ATOMIC_ACQUIRE)) {
+        MonotonicTimeMs wakeAt = nextMailCheckAt;
+        for (size_t i = 0; i < worker->clientCount; ++i) {
+            MonotonicTimeMs deadline = self->entries[worker->firstClientIndex + i].nextDeadline;
+            if (deadline < wakeAt) {
+                wakeAt = deadline;
+            }
+        }
+
+        MonotonicTimeMs now = monotonicTimeMsNow();
+        int timeoutMs = wakeAt > now ? (int) (wakeAt - now) : 0;
+        int eventCount = epoll_wait(worker->epollFd, events, RELAY_CLIENT_POOL_EPOLL_EVENT_COUNT, timeoutMs);
+
+        now = monotonicTimeMsNow();
+        for (int i = 0; i < eventCount; ++i) {
+            relayClientPoolServe(self, (size_t) events[i].data.u64, now);
+        }
+
+        // the mailboxes are polled, match threads do not wake the worker
+        bool checkMail = now >= nextMailCheckAt;
+        for (size_t i = 0; i < worker->clientCount; ++i) {
+            size_t clientIndex = worker->firstClientIndex + i;
+            const RelayClientPoolEntry* entry = &self->entries[clientIndex];
+            bool isDue = entry->nextDeadline <= now;
+            if (isDue || (checkMail && (!entry->isPolled || relayClientPoolHasMail(entry)))) {
+                relayClientPoolServe(self, clientIndex, now);
+            }
+        }
+
+        if (checkMail) {
+            nextMailCheckAt = now + self->updateIntervalMs;
+        }
+    }
+
+    return 0;
+}
+
+static void relayClientPoolPin(RelayClientPool* self, RelayClientPoolWorker* worker)
+{
+    if (worker->cpuIndex < 0) {
+        return;
+    }
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET((size_t) worker->cpuIndex, &cpuSet);
+    int err = pthread_setaffinity_np(worker->thread, sizeof(cpuSet), &cpuSet);
+    if (err != 0) {
+        CLOG_C_NOTICE(&self->log, "could not pin worker to cpu %d: %d", worker->cpuIndex, err)
+    }
+}
+
+static int relayClientPoolStartWorker(RelayClientPool* self, RelayClientPoolWorker* worker)
+{
+    worker->epollFd = epoll_create1(0);
+    if (worker->epollFd < 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "could not create epoll instance")
+        return -1;
+    }
+
+    for (size_t i = 0; i < worker->clientCount; ++i) {
+        size_t clientIndex = worker->firstClientIndex + i;
+        const RelayClient* client = &self->entries[clientIndex].client;
+        if (client->listenerCapacity > UINT16_MAX + 1 || client->connectorCapacity > UINT16_MAX + 1) {
+            CLOG_C_SOFT_ERROR(&self->log, "client %zu has more endpoints than fit in a pool packet", clientIndex)
+            return -4;
+        }
+        RelayClientPoolEntry* entry = &self->entries[clientIndex];
+        if (entry->listenerContexts == 0) {
+            entry->listenerContexts = IMPRINT_ALLOC_TYPE_COUNT(self->memory, RelayClientPoolEndpointContext,
+                                                               client->listenerCapacity);
+            entry->connectorContexts = IMPRINT_ALLOC_TYPE_COUNT(self->memory, RelayClientPoolEndpointContext,
+                                                                client->connectorCapacity);
+        }
+        entry->nextDeadline = 0;
+
+        const RelayTransportHooks* hooks = &client->socket.hooks;
+        int fd = hooks->pollFd != 0 ? hooks->pollFd(hooks->self) : -1;
+        entry->isPolled = fd >= 0;
+        if (fd < 0) {
+            // updated every time the mailboxes are checked
+            continue;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = clientIndex;
+        if (epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            CLOG_C_SOFT_ERROR(&self->log, "could not add client %zu to epoll", clientIndex)
+            return -2;
+        }
+    }
+
+    if (pthread_create(&worker->thread, 0, relayClientPoolWorkerMain, worker) != 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "could not start client pool worker")
+        return -3;
+    }
+
+    relayClientPoolPin(self, worker);
+
+    return 0;
+}
+
+static void relayClientPoolStopWorkers(RelayClientPool* self, size_t startedCount)
+{
+    __atomic_store_n(&self->isRunning, 0, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < self->workerCount; ++i) {
+        RelayClientPoolWorker* worker = &self->workers[i];
+        if (i < startedCount) {
+            pthread_join(worker->thread, 0);
+        }
+        if (worker->epollFd >= 0) {
+            close(worker->epollFd);
+            worker->epollFd = -1;
+        }
+    }
+}
+
+int relayClientPoolStart(RelayClientPool* self)
+{
+    if (__atomic_load_n(&self->isRunning, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+
+    __atomic_store_n(&self->isRunning, 1, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < self->workerCount; ++i) {
+        int err = relayClientPoolStartWorker(self, &self->workers[i]);
+        if (err < 0) {
+            relayClientPoolStopWorkers(self, i);
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+void relayClientPoolStop(RelayClientPool* self)
+{
+    if (!__atomic_load_n(&self->isRunning, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    relayClientPoolStopWorkers(self, self->workerCount);
+}
+
+/// Queues a packet for the worker to send on the next update of the client. Must only be called from the one
+/// thread that owns the client.
+/// @param connectionIndex the listener connection index, ignored for connectors
+/// @return zero if queued, negative if the packet is too big, an index is out of range or the mailbox is full
+int relayClientPoolSend(RelayClientPool* self, size_t clientIndex, RelayClientPoolEndpointKind endpointKind,
+                        size_t endpointIndex, size_t connectionIndex, const uint8_t* data, size_t octetCount)
+{
+    RelayClientPoolEntry* entry = &self->entries[clientIndex];
+    if (octetCount > DATAGRAM_TRANSPORT_MAX_SIZE) {
+        return -2;
+    }
+
+    if (endpointIndex > UINT16_MAX || connectionIndex >= RELAY_LISTENER_MAX_CONNECTION_CAPACITY) {
+        return -3;
+    }
+
+    if (relaySpscRingProducerAvailable(&entry->toClient) == 0) {
+        entry->droppedToClientCount++;
+        return -1;
+    }
+
+    RelayClientPoolPacket* packet = relaySpscRingProducerItem(&entry->toClient, 0);
+    packet->kind = RelayClientPoolPacketData;
+    packet->endpointKind = (uint8_t) endpointKind;
+    packet->endpointIndex = (uint16_t) endpointIndex;
+    packet->connectionIndex = (uint16_t) connectionIndex;
+    packet->octetCount = (uint16_t) octetCount;
+    tc_memcpy_octets(packet->octets, data, octetCount);
+    relaySpscRingProducerCommit(&entry->toClient, 1);
+
+    return 0;
+}
+
+static int relayClientPoolPostCommand(RelayClientPool* self, size_t clientIndex, const RelayClientPoolCommand* command)
+{
+    RelayClientPoolEntry* entry = &self->entries[clientIndex];
+    if (relaySpscRingProducerAvailable(&entry->commands) == 0) {
+        return -1;
+    }
+
+    *(RelayClientPoolCommand*) relaySpscRingProducerItem(&entry->commands, 0) = *command;
+    relaySpscRingProducerCommit(&entry->commands, 1);
+
+    return 0;
+}
+
+/// Asks the worker to start a listener on the client. The outcome is borrowed as a
+/// RelayClientPoolPacketHandshakeDone packet with the same tag, which also holds the listener index.
+/// Must only be called from the one thread that owns the client.
+/// @return zero if queued, negative if too many commands are waiting
+int relayClientPoolStartListen(RelayClientPool* self, size_t clientIndex, RelaySerializeApplicationId applicationId,
+                               RelaySerializeChannelId channelId, uint32_t tag)
+{
+    RelayClientPoolCommand command;
+    tc_mem_clear_type(&command);
+    command.kind = RelayClientPoolCommandStartListen;
+    command.applicationId = applicationId;
+    command.channelId = channelId;
+    command.tag = tag;
+
+    return relayClientPoolPostCommand(self, clientIndex, &command);
+}
+
+/// Same as relayClientPoolStartListen(), but for a connector
+int relayClientPoolStartConnect(RelayClientPool* self, size_t clientIndex, RelaySerializeUserId userId,
+                                RelaySerializeApplicationId applicationId, RelaySerializeChannelId channelId,
+                                uint32_t tag)
+{
+    RelayClientPoolCommand command;
+    tc_mem_clear_type(&command);
+    command.kind = RelayClientPoolCommandStartConnect;
+    command.userId = userId;
+    command.applicationId = applicationId;
+    command.channelId = channelId;
+    command.tag = tag;
+
+    return relayClientPoolPostCommand(self, clientIndex, &command);
+}
+
+static int relayClientPoolStopEndpoint(RelayClientPool* self, size_t clientIndex, RelayClientPoolCommandKind kind,
+                                       size_t endpointIndex)
+{
+    if (endpointIndex >= RELAY_CLIENT_POOL_NO_ENDPOINT) {
+        return -3;
+    }
+
+    RelayClientPoolCommand command;
+    tc_mem_clear_type(&command);
+    command.kind = (uint8_t) kind;
+    command.endpointIndex = (uint16_t) endpointIndex;
+
+    return relayClientPoolPostCommand(self, clientIndex, &command);
+}
+
+/// Asks the worker to stop the listener. A handshake that is still pending is reported as cancelled.
+int relayClientPoolStopListen(RelayClientPool* self, size_t clientIndex, size_t endpointIndex)
+{
+    return relayClientPoolStopEndpoint(self, clientIndex, RelayClientPoolCommandStopListen, endpointIndex);
+}
+
+int relayClientPoolStopConnect(RelayClientPool* self, size_t clientIndex, size_t endpointIndex)
+{
+    return relayClientPoolStopEndpoint(self, clientIndex, RelayClientPoolCommandStopConnect, endpointIndex);
+}
+
+/// Returns the oldest packet received by the client, or NULL if there is none.
+/// Must be released with relayClientPoolReleasePacket() before the next one can be borrowed.
+const RelayClientPoolPacket* relayClientPoolBorrowPacket(RelayClientPool* self, size_t clientIndex)
+{
+    RelayClientPoolEntry* entry = &self->entries[clientIndex];
+    if (relaySpscRingConsumerAvailable(&entry->fromClient) == 0) {
+        return 0;
+    }
+
+    return relaySpscRingConsumerItem(&entry->fromClient, 0);
+}
+
+void relayClientPoolReleasePacket(RelayClientPool* self, size_t clientIndex)
+{
+    relaySpscRingConsumerRelease(&self->entries[clientIndex].fromClient, 1);
+}
@@ -13,9 +13,7 @@ static int sendConnectRequest(RelayConnector* self, FldOutStream* outStream)
     data.connectToUserId = self->connectToUserId;
     data.appId = self->applicationId;
     data.channelId = self->channelId;
-    data.requestId = ++self->requestId;
-
-    self->waitTime = 10;
+    data.requestId = self->requestId;
 
     CLOG_C_DEBUG(&self->log, "sending connect request to userId %" PRIX64 " with sessionId:%" PRIX64,
                  data.connectToUserId, self->userSessionId)
@@ -26,7 +24,7 @@ static int sendConnectRequest(RelayConnector* self, FldOutStream* outStream)
 static int relayConnectorSendHandshakePacket(RelayConnector* self)
 {
     FldOutStream outStream;
-    fldOutStreamInit(&outStream, self->tempBuffer, DATAGRAM_TRANSPORT_MAX_SIZE);
+    fldOutStreamInit(&outStream, self->socket->scratchBuf, DATAGRAM_TRANSPORT_MAX_SIZE);
 
     int result = 0;
     switch (self->state) {
@@ -48,21 +46,25 @@ static int relayConnectorSendHandshakePacket(RelayConnector* self)
 
     CLOG_C_DEBUG(&self->log, "sending handshake %zd", outStream.pos)
 
-    return datagramTransportSend(&self->transportToRelayServer, outStream.octets, outStream.pos);
+    return relaySocketSendDatagram(self->socket, outStream.octets, outStream.pos);
 }
 
 static int relayConnectorUpdateOut(RelayConnector* self, MonotonicTimeMs now)
 {
-    (void) now;
-
-    if (self->waitTime > 0) {
-        self->waitTime--;
-        return 0;
+    switch (relayRetryUpdate(&self->retry, now)) {
+        case RelayRetryActionWait:
+            return 0;
+        case RelayRetryActionTimedOut:
+            CLOG_C_NOTICE(&self->log, "no connect response after %zu attempts, giving up", self->retry.attemptCount)
+            relayConnectorAbortHandshake(self, RELAY_RETRY_ERR_TIMED_OUT, RelayHandshakeResultTimedOut);
+            return RELAY_RETRY_ERR_TIMED_OUT;
+        case RelayRetryActionSend:
+            break;
     }
 
-
-
-    self->waitTime = 5;
+    if (self->retry.attemptCount > 1) {
+        self->handshakeRetryCount++;
+    }
 
     return relayConnectorSendHandshakePacket(self);
 }
@@ -73,11 +75,163 @@ int relayConnectorUpdate(RelayConnector* self, MonotonicTimeMs now)
     return relayConnectorUpdateOut(self, now);
 }
 
+/// The largest payload that fits in a datagram after the relay header
+static size_t relayConnectorMaxPayloadOctetCount(const RelayConnector* self)
+{
+    return DATAGRAM_TRANSPORT_MAX_SIZE - (size_t) self->header.octetCount;
+}
+
+static void relayConnectorQueuePreConnect(RelayConnector* self, const RelayPacketRef* ref)
+{
+    size_t droppedBefore = self->preConnectDropStats.droppedPacketCount;
+    relayPacketQueuePushWithPolicy(&self->preConnectQueue, self->pool, ref, RelayPacketOverflowPolicyDropOldest,
+                                   &self->preConnectDropStats);
+    if (self->preConnectDropStats.droppedPacketCount != droppedBefore) {
+        CLOG_C_NOTICE(&self->log, "pre-connect queue is full, dropping the oldest packet")
+    }
+}
+
+/// Keeps a copy of a packet that is sent before the connection id is known
+static int relayConnectorSendPreConnect(RelayConnector* self, const uint8_t* data, size_t octetCount)
+{
+    if (octetCount > relayConnectorMaxPayloadOctetCount(self)) {
+        CLOG_C_SOFT_ERROR(&self->log, "packet is too big to send to relay %zu", octetCount)
+        return -2;
+    }
+
+    RelayPacketRef ref;
+    if (relayPacketPoolAlloc(self->pool, &ref.slotIndex) < 0) {
+        CLOG_C_NOTICE(&self->log, "packet pool is exhausted, dropping pre-connect packet")
+        self->preConnectDropStats.droppedPacketCount++;
+        self->preConnectDropStats.droppedOctetCount += octetCount;
+        return -1;
+    }
+
+    tc_memcpy_octets(relayPacketPoolSlotOctets(self->pool, ref.slotIndex), data, octetCount);
+    ref.octetOffset = 0;
+    ref.octetCount = (uint16_t) octetCount;
+    ref.connectionIndex = 0;
+    relayConnectorQueuePreConnect(self, &ref);
+
+    return 0;
+}
+
+/// Packets that are sent while connecting are queued and sent as soon as the connection id is assigned.
 ssize_t relayConnectorSend(RelayConnector* self, const uint8_t* data, size_t octetCount)
 {
+    if (self->state == RelayConnectorStateIdle) {
+        CLOG_C_SOFT_ERROR(&self->log, "can not send on a connector that is not started")
+        return -4;
+    }
+
+    if (self->state == RelayConnectorStateConnecting) {
+        CLOG_C_DEBUG(&self->log, "queueing packet until connected %zu", octetCount)
+        return relayConnectorSendPreConnect(self, data, octetCount);
+    }
+
     CLOG_C_DEBUG(&self->log, "sending packet to relay %zu", octetCount)
-    return relaySocketSendPacket(self->transportToRelayServer, self->userSessionId, self->connectionId, data,
-                                 octetCount);
+    int result = relaySocketSendPacketWithHeader(self->socket, &self->header, data, octetCount);
+    if (result >= 0) {
+        relayTrafficStatsAddOut(&self->traffic, octetCount);
+    }
+
+    return result;
+}
+
+/// Frees the pre-connect slot of a reservation that was never committed
+static void relayConnectorReleaseReservedSlot(RelayConnector* self)
+{
+    if (self->reservedPreConnectSlot != RELAY_PACKET_SLOT_NONE) {
+        relayPacketPoolFree(self->pool, self->reservedPreConnectSlot);
+        self->reservedPreConnectSlot = RELAY_PACKET_SLOT_NONE;
+    }
+}
+
+/// Returns a pointer inside the outgoing datagram, directly after the relay header, where the payload
+/// can be serialized. Must be followed by relayConnectorCommit() before anything else is sent.
+/// While connecting, the payload is written to a packet pool slot that is queued on commit.
+uint8_t* relayConnectorReserve(RelayConnector* self, size_t* outMaxOctetCount)
+{
+    if (self->state == RelayConnectorStateIdle) {
+        CLOG_C_SOFT_ERROR(&self->log, "can not reserve on a connector that is not started")
+        *outMaxOctetCount = 0;
+        return 0;
+    }
+
+    // a reservation that was not committed is replaced
+    relayConnectorReleaseReservedSlot(self);
+
+    if (self->state == RelayConnectorStateConnecting) {
+        if (relayPacketPoolAlloc(self->pool, &self->reservedPreConnectSlot) < 0) {
+            CLOG_C_NOTICE(&self->log, "packet pool is exhausted, can not reserve pre-connect packet")
+            self->reservedPreConnectSlot = RELAY_PACKET_SLOT_NONE;
+            *outMaxOctetCount = 0;
+            return 0;
+        }
+        *outMaxOctetCount = relayConnectorMaxPayloadOctetCount(self);
+        return relayPacketPoolSlotOctets(self->pool, self->reservedPreConnectSlot);
+    }
+
+    return relaySocketReservePacketWithHeader(self->socket, &self->header, outMaxOctetCount);
+}
+
+int relayConnectorCommit(RelayConnector* self, size_t octetCount)
+{
+    if (self->reservedPreConnectSlot != RELAY_PACKET_SLOT_NONE) {
+        RelayPacketRef ref;
+        ref.slotIndex = self->reservedPreConnectSlot;
+        ref.octetOffset = 0;
+        ref.octetCount = (uint16_t) octetCount;
+        ref.connectionIndex = 0;
+        self->reservedPreConnectSlot = RELAY_PACKET_SLOT_NONE;
+        if (octetCount > relayConnectorMaxPayloadOctetCount(self)) {
+            CLOG_C_SOFT_ERROR(&self->log, "packet is too big to send to relay %zu", octetCount)
+            relayPacketPoolFree(self->pool, ref.slotIndex);
+            return -2;
+        }
+        CLOG_C_DEBUG(&self->log, "queueing reserved packet until connected %zu", octetCount)
+        relayConnectorQueuePreConnect(self, &ref);
+        return 0;
+    }
+
+    CLOG_C_DEBUG(&self->log, "sending reserved packet to relay %zu", octetCount)
+    int result = relaySocketCommitPacket(self->socket, octetCount);
+    if (result >= 0) {
+        relayTrafficStatsAddOut(&self->traffic, octetCount);
+    }
+
+    return result;
+}
+
+/// Sends the packets that were queued while connecting, in one batch if the socket supports it.
+/// Called when the connection id has been assigned.
+int relayConnectorFlushPreConnectQueue(RelayConnector* self)
+{
+    if (relayPacketQueueCount(&self->preConnectQueue) == 0) {
+        return 0;
+    }
+
+    CLOG_C_DEBUG(&self->log, "sending %zu packets that were queued while connecting",
+                 relayPacketQueueCount(&self->preConnectQueue))
+
+    bool startedBatch = relaySocketBeginBatch(self->socket);
+
+    int result = 0;
+    RelayPacketRef ref;
+    while (relayPacketQueuePop(&self->preConnectQueue, &ref)) {
+        const uint8_t* octets = relayPacketPoolSlotOctets(self->pool, ref.slotIndex) + ref.octetOffset;
+        int sendErr = relaySocketSendPacketWithHeader(self->socket, &self->header, octets, ref.octetCount);
+        if (sendErr < 0) {
+            result = sendErr;
+        } else {
+            relayTrafficStatsAddOut(&self->traffic, ref.octetCount);
+        }
+        relayPacketPoolFree(self->pool, ref.slotIndex);
+    }
+
+    int flushErr = relaySocketEndBatch(self->socket, startedBatch);
+
+    return result < 0 ? result : flushErr;
 }
 
 static int transportSend(void* _self, const uint8_t* data, size_t size)
@@ -86,28 +240,55 @@ static int transportSend(void* _self, const uint8_t* data, size_t size)
 
     CLOG_C_DEBUG(&self->log, "sending to relay: octetCount:%zu", size)
 
-    return relaySocketSendPacket(self->transportToRelayServer, self->userSessionId, self->connectionId, data, size);
+    return (int) relayConnectorSend(self, data, size);
 }
 
-static ssize_t relayConnectorReceivePacket(RelayConnector* self, uint8_t* octets, size_t maxOctetCount)
+/// Hands out the oldest received packet without copying it. The payload stays valid until
+/// relayConnectorReleasePacket() is called for it.
+/// @return 1 if a packet was borrowed, 0 if there are no packets
+int relayConnectorBorrowPacket(RelayConnector* self, RelayReceivedPacket* outPacket)
 {
-    size_t count = discoidBufferReadAvailable(&self->inBuffer);
-    if (count < sizeof(uint16_t)) {
+    RelayPacketRef ref;
+    if (!relayPacketQueuePop(&self->inQueue, &ref)) {
         return 0;
     }
 
-    uint16_t followingOctets;
-    discoidBufferRead(&self->inBuffer, (uint8_t*) &followingOctets, sizeof(followingOctets));
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    uint32_t nowMs = (uint32_t) monotonicTimeMsNow();
+    relayLatencyHistogramAdd(&self->residency, nowMs - ref.queuedAtMs);
+    relayLatencyHistogramAdd(&self->dispatchLatency, nowMs - ref.receivedAtMs);
+#endif
+
+    outPacket->octets = relayPacketPoolSlotOctets(self->pool, ref.slotIndex) + ref.octetOffset;
+    outPacket->octetCount = ref.octetCount;
+    outPacket->connectionIndex = 0;
+    outPacket->slotIndex = ref.slotIndex;
+
+    return 1;
+}
+
+void relayConnectorReleasePacket(RelayConnector* self, const RelayReceivedPacket* packet)
+{
+    relayPacketPoolFree(self->pool, packet->slotIndex);
+}
+
+static ssize_t relayConnectorReceivePacket(RelayConnector* self, uint8_t* octets, size_t maxOctetCount)
+{
+    RelayReceivedPacket packet;
+    if (relayConnectorBorrowPacket(self, &packet) == 0) {
+        return 0;
+    }
 
-    if (maxOctetCount < followingOctets) {
-        CLOG_C_SOFT_ERROR(&self->log, "can not read incoming packet from circular buffer")
-        discoidBufferSkip(&self->inBuffer, followingOctets);
+    if (maxOctetCount < packet.octetCount) {
+        CLOG_C_SOFT_ERROR(&self->log, "can not read incoming packet from queue")
+        relayConnectorReleasePacket(self, &packet);
         return -2;
     }
 
-    discoidBufferRead(&self->inBuffer, octets, followingOctets);
+    tc_memcpy_octets(octets, packet.octets, packet.octetCount);
+    relayConnectorReleasePacket(self, &packet);
 
-    return followingOctets;
+    return (ssize_t) packet.octetCount;
 }
 
 static ssize_t transportReceive(void* _self, uint8_t* data, size_t size)
@@ -125,44 +306,183 @@ static ssize_t transportReceive(void* _self, uint8_t* data, size_t size)
     return octetCount;
 }
 
+/// Queues a packet that is already in a pool slot. Ownership of the slot moves to the connector.
+int relayConnectorPushPacketRef(RelayConnector* self, const RelayPacketRef* ref)
+{
+    relayTrafficStatsAddIn(&self->traffic, ref->octetCount);
+
+    size_t droppedBefore = self->dropStats.droppedPacketCount;
+    relayPacketQueuePushWithPolicy(&self->inQueue, self->pool, ref, self->overflowPolicy, &self->dropStats);
+    if (self->overflowPolicy != RelayPacketOverflowPolicyKeepLatest &&
+        self->dropStats.droppedPacketCount != droppedBefore) {
+        CLOG_C_NOTICE(&self->log, "dropping packets since in queue is full")
+    }
+
+    size_t queuedCount = relayPacketQueueCount(&self->inQueue);
+    if (queuedCount > self->inQueueHighWater) {
+        self->inQueueHighWater = queuedCount;
+    }
+
+    return 0;
+}
+
 int relayConnectorPushPacket(RelayConnector* self, const uint8_t* data, size_t octetCountInPacket)
 {
-    if (discoidBufferWriteAvailable(&self->inBuffer) < octetCountInPacket + sizeof(uint16_t)) {
-        CLOG_C_NOTICE(&self->log, "dropping packets since in buffer is full")
+    if (octetCountInPacket > RELAY_PACKET_SLOT_OCTET_COUNT) {
+        CLOG_C_SOFT_ERROR(&self->log, "packet is too big %zu", octetCountInPacket)
+        return -2;
+    }
+
+    RelayPacketRef ref;
+    if (relayPacketPoolAlloc(self->pool, &ref.slotIndex) < 0) {
+        CLOG_C_NOTICE(&self->log, "dropping packets since packet pool is exhausted")
         return -1;
     }
 
-    discoidBufferWrite(&self->inBuffer, (uint8_t*) &octetCountInPacket, sizeof(uint16_t));
-    discoidBufferWrite(&self->inBuffer, data, octetCountInPacket);
+    tc_memcpy_octets(relayPacketPoolSlotOctets(self->pool, ref.slotIndex), data, octetCountInPacket);
+    ref.octetOffset = 0;
+    ref.octetCount = (uint16_t) octetCountInPacket;
+    ref.connectionIndex = 0;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    ref.receivedAtMs = (uint32_t) monotonicTimeMsNow();
+    ref.queuedAtMs = ref.receivedAtMs;
+#endif
 
-    return 0;
+    return relayConnectorPushPacketRef(self, &ref);
 }
 
-int relayConnectorInit(RelayConnector* self, struct ImprintAllocator* memory, Clog log)
+int relayConnectorInit(RelayConnector* self, RelayPacketPool* pool, RelayBufferPool* bufferPool, Clog log)
 {
     self->log = log;
-    CLOG_C_VERBOSE(&self->log, "initializing relay client with discoid 32K buffer")
+    CLOG_C_VERBOSE(&self->log, "initializing relay connector")
     self->state = RelayConnectorStateIdle;
+    self->connectionId = 0;
+    tc_mem_clear_type(&self->header);
+    self->requestId = 0;
+    self->socket = 0;
     self->connectorTransport.self = self;
     self->connectorTransport.send = transportSend;
     self->connectorTransport.receive = transportReceive;
-    self->waitTime = 0;
-    discoidBufferInit(&self->inBuffer, memory, 32 * 1024);
+    self->lastError = 0;
+    relayHandshakeCompletionClear(&self->completion);
+    self->pool = pool;
+    self->bufferPool = bufferPool;
+    relayPacketQueueInit(&self->inQueue, 0, 0);
+    relayPacketQueueInit(&self->preConnectQueue, 0, 0);
+    self->reservedPreConnectSlot = RELAY_PACKET_SLOT_NONE;
+    self->overflowPolicy = RelayPacketOverflowPolicyDropNewest;
+    self->dropStats.droppedPacketCount = 0;
+    self->dropStats.droppedOctetCount = 0;
+    self->preConnectDropStats.droppedPacketCount = 0;
+    self->preConnectDropStats.droppedOctetCount = 0;
+    tc_mem_clear_type(&self->traffic);
+    self->inQueueHighWater = 0;
+    self->handshakeRetryCount = 0;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    tc_mem_clear_type(&self->residency);
+    tc_mem_clear_type(&self->dispatchLatency);
+#endif
 
     return 0;
 }
 
-void relayConnectorReInit(RelayConnector* self, DatagramTransport* transportToRelayServer,
+void relayConnectorReInit(RelayConnector* self, RelaySocket* socket,
                           RelaySerializeUserSessionId userSessionId, RelaySerializeUserId userId,
-                          RelaySerializeApplicationId applicationId, RelaySerializeChannelId channelId)
+                          RelaySerializeApplicationId applicationId, RelaySerializeChannelId channelId,
+                          RelaySerializeRequestId requestId, const RelayRetrySetup* retrySetup)
 {
-    self->transportToRelayServer = *transportToRelayServer;
+    self->socket = socket;
     self->state = RelayConnectorStateConnecting;
     self->connectToUserId = userId;
     self->applicationId = applicationId;
     self->channelId = channelId;
+    self->requestId = requestId;
     self->userSessionId = userSessionId;
-    self->waitTime = 0;
+    relayPacketHeaderInit(&self->header, userSessionId, 0);
+    self->lastError = 0;
+    relayHandshakeCompletionClear(&self->completion);
+    relayRetryInit(&self->retry, retrySetup, userSessionId ^ userId ^ ((uint64_t) channelId << 56));
+
+    if (self->inQueue.refs == 0) {
+        // the queues are only allocated while the connector is in use
+        RelayPacketRef* refs = relayBufferPoolAlloc(self->bufferPool);
+        relayPacketQueueInit(&self->inQueue, refs, RELAY_CONNECTOR_IN_QUEUE_CAPACITY);
+        relayPacketQueueInit(&self->preConnectQueue, refs + RELAY_CONNECTOR_IN_QUEUE_CAPACITY,
+                             RELAY_CONNECTOR_PRE_CONNECT_QUEUE_CAPACITY);
+    } else {
+        relayPacketQueueClear(&self->inQueue, self->pool);
+        relayPacketQueueClear(&self->preConnectQueue, self->pool);
+    }
+}
+
+/// The octet count of the buffer a connector needs while it is active
+size_t relayConnectorBufferOctetCount(void)
+{
+    return (RELAY_CONNECTOR_IN_QUEUE_CAPACITY + RELAY_CONNECTOR_PRE_CONNECT_QUEUE_CAPACITY) * sizeof(RelayPacketRef);
+}
 
-    discoidBufferReset(&self->inBuffer);
+/// Calls the completion when the handshake succeeds, times out, is rejected or is cancelled.
+/// If the handshake is already over, it is called at once.
+void relayConnectorSetCompletion(RelayConnector* self, RelayHandshakeCompletion completion)
+{
+    self->completion = completion;
+
+    switch (self->state) {
+        case RelayConnectorStateConnecting:
+            break;
+        case RelayConnectorStateConnected:
+            relayHandshakeCompletionDeliver(&self->completion, RelayHandshakeResultSucceeded);
+            break;
+        case RelayConnectorStateIdle:
+            relayHandshakeCompletionDeliver(&self->completion, relayHandshakeResultFromError(self->lastError));
+            break;
+    }
+}
+
+/// Disconnects and reports the result, instead of the cancel that relayConnectorDisconnect() reports
+void relayConnectorAbortHandshake(RelayConnector* self, int error, RelayHandshakeResult result)
+{
+    RelayHandshakeCompletion completion = self->completion;
+    relayHandshakeCompletionClear(&self->completion);
+
+    relayConnectorDisconnect(self);
+    self->lastError = error;
+
+    relayHandshakeCompletionDeliver(&completion, result);
+}
+
+/// Stops the connector and returns its buffers to the buffer pool
+void relayConnectorDisconnect(RelayConnector* self)
+{
+    bool wasConnecting = self->state == RelayConnectorStateConnecting;
+
+    relayConnectorReleaseReservedSlot(self);
+
+    if (self->inQueue.refs != 0) {
+        relayPacketQueueClear(&self->inQueue, self->pool);
+        relayPacketQueueClear(&self->preConnectQueue, self->pool);
+        relayBufferPoolFree(self->bufferPool, self->inQueue.refs);
+        relayPacketQueueInit(&self->inQueue, 0, 0);
+        relayPacketQueueInit(&self->preConnectQueue, 0, 0);
+    }
+
+    self->state = RelayConnectorStateIdle;
+    self->connectionId = 0;
+    // the cached header must not keep pointing at the connection that is gone
+    relayPacketHeaderInit(&self->header, self->userSessionId, 0);
+
+    if (wasConnecting) {
+        relayHandshakeCompletionDeliver(&self->completion, RelayHandshakeResultCancelled);
+    }
+}
+
+void relayConnectorDestroy(RelayConnector* self)
+{
+    relayConnectorDisconnect(self);
+}
+
+/// Selects what happens to packets arriving when the in queue is full. Dropped packets are counted in dropStats.
+void relayConnectorSetOverflowPolicy(RelayConnector* self, RelayPacketOverflowPolicy policy)
+{
+    self->overflowPolicy = policy;
 }
@@ -0,0 +1,90 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <imprint/allocator.h>
+#include <relay-client/early_arrival.h>
+#include <tiny-libc/tiny_libc.h>
+
+/// @param capacity zero disables holding, every early packet is dropped
+void relayEarlyArrivalsInit(RelayEarlyArrivals* self, struct ImprintAllocator* memory, size_t capacity,
+                            MonotonicTimeMs holdTimeMs)
+{
+    self->entries = capacity > 0 ? IMPRINT_ALLOC_TYPE_COUNT(memory, RelayEarlyArrival, capacity) : 0;
+    self->capacity = capacity;
+    self->count = 0;
+    self->holdTimeMs = holdTimeMs;
+    tc_mem_clear_type(&self->stats);
+}
+
+static void relayEarlyArrivalsRemoveFirst(RelayEarlyArrivals* self, size_t removeCount)
+{
+    for (size_t i = removeCount; i < self->count; ++i) {
+        self->entries[i - removeCount] = self->entries[i];
+    }
+    self->count -= removeCount;
+}
+
+/// Keeps the packet until the connection id is known or the hold time has passed.
+/// Ownership of the slot moves to the early arrivals.
+/// @return false if holding is disabled and the slot was released
+bool relayEarlyArrivalsHold(RelayEarlyArrivals* self, RelayPacketPool* pool, RelaySerializeConnectionId connectionId,
+                            const RelayPacketRef* ref, MonotonicTimeMs now)
+{
+    if (self->capacity == 0) {
+        relayPacketPoolFree(pool, ref->slotIndex);
+        return false;
+    }
+
+    if (self->count == self->capacity) {
+        relayPacketPoolFree(pool, self->entries[0].ref.slotIndex);
+        relayEarlyArrivalsRemoveFirst(self, 1);
+        self->stats.evictedCount++;
+    }
+
+    RelayEarlyArrival* entry = &self->entries[self->count++];
+    entry->connectionId = connectionId;
+    entry->ref = *ref;
+    entry->expiresAt = now + self->holdTimeMs;
+    self->stats.heldCount++;
+
+    return true;
+}
+
+/// Moves the held packets for the connection id, in arrival order, to outRefs. Ownership of their slots moves
+/// to the caller.
+/// @return the number of packets in outRefs
+size_t relayEarlyArrivalsTake(RelayEarlyArrivals* self, RelaySerializeConnectionId connectionId,
+                              RelayPacketRef* outRefs, size_t maxCount)
+{
+    size_t takenCount = 0;
+    size_t keptCount = 0;
+
+    for (size_t i = 0; i < self->count; ++i) {
+        const RelayEarlyArrival* entry = &self->entries[i];
+        if (entry->connectionId == connectionId && takenCount < maxCount) {
+            outRefs[takenCount++] = entry->ref;
+            continue;
+        }
+        self->entries[keptCount++] = *entry;
+    }
+
+    self->count = keptCount;
+    self->stats.replayedCount += takenCount;
+
+    return takenCount;
+}
+
+/// Releases packets that have been held longer than the hold time
+void relayEarlyArrivalsExpire(RelayEarlyArrivals* self, RelayPacketPool* pool, MonotonicTimeMs now)
+{
+    // entries are in arrival order and all are held equally long, so the expired ones are first
+    size_t expiredCount = 0;
+    while (expiredCount < self->count && self->entries[expiredCount].expiresAt <= now) {
+        relayPacketPoolFree(pool, self->entries[expiredCount].ref.slotIndex);
+        expiredCount++;
+    }
+
+    relayEarlyArrivalsRemoveFirst(self, expiredCount);
+    self->stats.expiredCount += expiredCount;
+}
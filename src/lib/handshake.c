@@ -0,0 +1,67 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <relay-client/handshake.h>
+
+/// The result of a handshake that is over, from the lastError of its listener or connector
+RelayHandshakeResult relayHandshakeResultFromError(int lastError)
+{
+    switch (lastError) {
+        case RELAY_RETRY_ERR_TIMED_OUT:
+            return RelayHandshakeResultTimedOut;
+        case RELAY_HANDSHAKE_ERR_REJECTED:
+            return RelayHandshakeResultRejected;
+        default:
+            return RelayHandshakeResultCancelled;
+    }
+}
+
+void relayHandshakeCompletionClear(RelayHandshakeCompletion* self)
+{
+    self->onDone = 0;
+    self->userData = 0;
+}
+
+/// The completion is cleared before it is called, so the callback is free to stop or start listeners and connectors
+void relayHandshakeCompletionDeliver(RelayHandshakeCompletion* self, RelayHandshakeResult result)
+{
+    RelayHandshakeCompletion completion = *self;
+    relayHandshakeCompletionClear(self);
+
+    if (completion.onDone != 0) {
+        completion.onDone(completion.userData, result);
+    }
+}
+
+/// @param resume called with coroutine when the result is known, it can be zero if the result is polled instead
+void relayHandshakeAwaitableInit(RelayHandshakeAwaitable* self, RelayHandshakeResumeFn resume, void* coroutine)
+{
+    self->result = RelayHandshakeResultPending;
+    self->resume = resume;
+    self->coroutine = coroutine;
+}
+
+static void relayHandshakeAwaitableOnDone(void* userData, RelayHandshakeResult result)
+{
+    RelayHandshakeAwaitable* self = (RelayHandshakeAwaitable*) userData;
+    self->result = result;
+    if (self->resume != 0) {
+        self->resume(self->coroutine);
+    }
+}
+
+/// The completion to give to the listener or connector. The awaitable must outlive the handshake.
+RelayHandshakeCompletion relayHandshakeAwaitableCompletion(RelayHandshakeAwaitable* self)
+{
+    RelayHandshakeCompletion completion;
+    completion.onDone = relayHandshakeAwaitableOnDone;
+    completion.userData = self;
+
+    return completion;
+}
+
+bool relayHandshakeAwaitableIsReady(const RelayHandshakeAwaitable* self)
+{
+    return self->result != RelayHandshakeResultPending;
+}
@@ -0,0 +1,320 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 200809L
+#include <poll.h>
+#include <relay-client/io_thread.h>
+#include <sys/eventfd.h>
+#include <tiny-libc/tiny_libc.h>
+#include <time.h>
+#include <unistd.h>
+
+/// @param slotCount the maximum number of packet pool slots lent to the I/O thread, must be a power of two
+void relayIoThreadInit(RelayIoThread* self, struct ImprintAllocator* memory, size_t slotCount, Clog log)
+{
+    self->log = log;
+    self->slotCount = slotCount;
+    relaySpscRingInit(&self->freeSlots, memory, sizeof(RelayIoSlot), slotCount);
+    relaySpscRingInit(&self->receivedSlots, memory, sizeof(RelayIoSlot), slotCount);
+    relaySpscRingInit(&self->outDatagrams, memory, sizeof(RelayIoDatagram), RELAY_IO_THREAD_OUT_DATAGRAM_CAPACITY);
+    self->droppedOutDatagramCount = 0;
+    self->wakeFd = -1;
+    self->isSleeping = 0;
+    self->isRunning = 0;
+    self->isSendBlocked = false;
+    self->isInitialized = true;
+}
+
+/// Sends what the game thread has queued. If the transport takes only part of a batch the rest stays queued, and
+/// the thread waits for the socket to become writable before it tries again. On a send error the rest is dropped,
+/// the same as relaySocketFlush() does.
+/// @return the number of datagrams that were sent or dropped
+static size_t relayIoThreadSend(RelayIoThread* self)
+{
+    self->isSendBlocked = false;
+
+    size_t count = relaySpscRingConsumerAvailable(&self->outDatagrams);
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t sentCount = 0;
+    size_t doneCount = count;
+    if (self->hooks.sendMany != 0) {
+        RelayDatagram datagrams[RELAY_IO_THREAD_BATCH_COUNT];
+        while (sentCount < count) {
+            size_t batchCount = count - sentCount;
+            if (batchCount > RELAY_IO_THREAD_BATCH_COUNT) {
+                batchCount = RELAY_IO_THREAD_BATCH_COUNT;
+            }
+            for (size_t i = 0; i < batchCount; ++i) {
+                RelayIoDatagram* item = relaySpscRingConsumerItem(&self->outDatagrams, sentCount + i);
+                datagrams[i].octets = item->octets;
+                datagrams[i].octetCount = item->octetCount;
+            }
+            int batchResult = self->hooks.sendMany(self->hooks.self, datagrams, batchCount);
+            if (batchResult < 0) {
+                self->stats.sendErrorCount++;
+                break;
+            }
+            if (batchResult == 0) {
+                self->isSendBlocked = true;
+                doneCount = sentCount;
+                break;
+            }
+            sentCount += (size_t) batchResult;
+        }
+    } else {
+        for (; sentCount < count; ++sentCount) {
+            const RelayIoDatagram* item = relaySpscRingConsumerItem(&self->outDatagrams, sentCount);
+            if (datagramTransportSend(&self->transport, item->octets, item->octetCount) < 0) {
+                self->stats.sendErrorCount++;
+                break;
+            }
+        }
+    }
+
+    self->stats.sentDatagramCount += sentCount;
+    self->stats.droppedDatagramCount += doneCount - sentCount;
+    relaySpscRingConsumerRelease(&self->outDatagrams, doneCount);
+
+    return doneCount;
+}
+
+static size_t relayIoThreadReceiveCapacity(const RelayIoThread* self)
+{
+    size_t maxCount = relaySpscRingConsumerAvailable(&self->freeSlots);
+    size_t receivedSpace = relaySpscRingProducerAvailable(&self->receivedSlots);
+
+    return maxCount < receivedSpace ? maxCount : receivedSpace;
+}
+
+static size_t relayIoThreadReceive(RelayIoThread* self)
+{
+    size_t maxCount = relayIoThreadReceiveCapacity(self);
+    if (maxCount > RELAY_IO_THREAD_BATCH_COUNT) {
+        maxCount = RELAY_IO_THREAD_BATCH_COUNT;
+    }
+    if (maxCount == 0) {
+        return 0;
+    }
+
+    RelayDatagram datagrams[RELAY_IO_THREAD_BATCH_COUNT];
+    for (size_t i = 0; i < maxCount; ++i) {
+        const RelayIoSlot* slot = relaySpscRingConsumerItem(&self->freeSlots, i);
+        datagrams[i].octets = slot->octets;
+        datagrams[i].octetCount = 0;
+    }
+
+    size_t count = 0;
+    if (self->hooks.receiveMany != 0) {
+        ssize_t receivedCount = self->hooks.receiveMany(self->hooks.self, datagrams, maxCount);
+        if (receivedCount < 0) {
+            self->stats.receiveErrorCount++;
+        } else {
+            count = (size_t) receivedCount;
+        }
+    } else {
+        for (; count < maxCount; ++count) {
+            ssize_t octetCount = datagramTransportReceive(&self->transport, datagrams[count].octets,
+                                                          DATAGRAM_TRANSPORT_MAX_SIZE);
+            if (octetCount < 0) {
+                self->stats.receiveErrorCount++;
+                break;
+            }
+            if (octetCount == 0) {
+                break;
+            }
+            datagrams[count].octetCount = (size_t) octetCount;
+        }
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    MonotonicTimeMs receivedAt = monotonicTimeMsNow();
+#endif
+
+    // datagrams with zero octets are handed back as well, the game thread returns their slots to the pool
+    for (size_t i = 0; i < count; ++i) {
+        const RelayIoSlot* freeSlot = relaySpscRingConsumerItem(&self->freeSlots, i);
+        RelayIoSlot* receivedSlot = relaySpscRingProducerItem(&self->receivedSlots, i);
+        receivedSlot->octets = freeSlot->octets;
+        receivedSlot->slotIndex = freeSlot->slotIndex;
+        receivedSlot->octetCount = (uint16_t) datagrams[i].octetCount;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+        receivedSlot->receivedAt = receivedAt;
+#endif
+    }
+
+    relaySpscRingProducerCommit(&self->receivedSlots, count);
+    relaySpscRingConsumerRelease(&self->freeSlots, count);
+    self->stats.receivedDatagramCount += count;
+
+    return count;
+}
+
+/// Blocks until the transport has something to receive or the game thread wakes the thread up
+static void relayIoThreadWait(RelayIoThread* self)
+{
+    int socketFd = self->hooks.pollFd != 0 ? self->hooks.pollFd(self->hooks.self) : -1;
+    if (socketFd < 0 || self->wakeFd < 0) {
+        struct timespec idleSleep;
+        idleSleep.tv_sec = 0;
+        idleSleep.tv_nsec = RELAY_IO_THREAD_IDLE_SLEEP_US * 1000;
+        nanosleep(&idleSleep, 0);
+        return;
+    }
+
+    // announce the sleep before checking the rings a last time, relayIoThreadWake() does it the other way
+    // around, so either this thread sees the new work or the game thread sees that it must signal
+    __atomic_store_n(&self->isSleeping, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    bool canReceive = relayIoThreadReceiveCapacity(self) > 0;
+    // datagrams the transport did not take are not work until the socket is writable again
+    bool hasWork = (!self->isSendBlocked && relaySpscRingConsumerAvailable(&self->outDatagrams) > 0) ||
+                   !__atomic_load_n(&self->isRunning, __ATOMIC_ACQUIRE);
+    if (!hasWork) {
+        struct pollfd fds[2];
+        fds[0].fd = self->wakeFd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        // without slots to receive into, a readable socket would only keep waking the thread up
+        fds[1].fd = canReceive || self->isSendBlocked ? socketFd : -1;
+        fds[1].events = (short) ((canReceive ? POLLIN : 0) | (self->isSendBlocked ? POLLOUT : 0));
+        fds[1].revents = 0;
+        poll(fds, 2, -1);
+    }
+
+    if (!__atomic_exchange_n(&self->isSleeping, 0, __ATOMIC_SEQ_CST)) {
+        // the game thread has signaled, consume it so the next poll() does not return at once
+        uint64_t signalCount;
+        ssize_t readCount = read(self->wakeFd, &signalCount, sizeof(signalCount));
+        (void) readCount;
+    }
+}
+
+static void* relayIoThreadMain(void* _self)
+{
+    RelayIoThread* self = (RelayIoThread*) _self;
+
+    while (__atomic_load_n(&self->isRunning, __ATOMIC_ACQUIRE)) {
+        size_t sentCount = relayIoThreadSend(self);
+        size_t receivedCount = relayIoThreadReceive(self);
+        if (sentCount == 0 && receivedCount == 0) {
+            relayIoThreadWait(self);
+        }
+    }
+
+    // send what the game thread queued before it stopped the thread
+    relayIoThreadSend(self);
+
+    return 0;
+}
+
+/// Starts the thread that from now on is the only user of transport and hooks
+int relayIoThreadStart(RelayIoThread* self, DatagramTransport transport, RelayTransportHooks hooks)
+{
+    self->transport = transport;
+    self->hooks = hooks;
+    tc_mem_clear_type(&self->stats);
+    relaySpscRingReset(&self->freeSlots);
+    relaySpscRingReset(&self->receivedSlots);
+    relaySpscRingReset(&self->outDatagrams);
+
+    self->isSleeping = 0;
+    self->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (self->wakeFd < 0) {
+        CLOG_C_NOTICE(&self->log, "could not create io thread eventfd, falling back to sleeping")
+    }
+
+    __atomic_store_n(&self->isRunning, 1, __ATOMIC_RELEASE);
+    int err = pthread_create(&self->thread, 0, relayIoThreadMain, self);
+    if (err != 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "could not start io thread %d", err)
+        __atomic_store_n(&self->isRunning, 0, __ATOMIC_RELEASE);
+        if (self->wakeFd >= 0) {
+            close(self->wakeFd);
+            self->wakeFd = -1;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/// Waits for the thread to send the remaining datagrams and exit. Slots still in the rings are left for the
+/// game thread to reclaim.
+void relayIoThreadStop(RelayIoThread* self)
+{
+    __atomic_store_n(&self->isRunning, 0, __ATOMIC_SEQ_CST);
+    relayIoThreadWake(self);
+    pthread_join(self->thread, 0);
+
+    if (self->wakeFd >= 0) {
+        close(self->wakeFd);
+        self->wakeFd = -1;
+    }
+}
+
+/// Called by the game thread after it has committed to one of the rings, wakes the I/O thread if it is blocked.
+/// Only costs a system call when the thread is actually sleeping.
+void relayIoThreadWake(RelayIoThread* self)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (self->wakeFd < 0 || !__atomic_exchange_n(&self->isSleeping, 0, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+
+    uint64_t signalCount = 1;
+    ssize_t writtenCount = write(self->wakeFd, &signalCount, sizeof(signalCount));
+    (void) writtenCount;
+}
+
+static int relayIoThreadTransportSend(void* _self, const uint8_t* data, size_t octetCount)
+{
+    RelayIoThread* self = (RelayIoThread*) _self;
+
+    if (octetCount > DATAGRAM_TRANSPORT_MAX_SIZE) {
+        return -2;
+    }
+
+    if (relaySpscRingProducerAvailable(&self->outDatagrams) == 0) {
+        // the I/O thread is not keeping up, the datagram is lost
+        self->droppedOutDatagramCount++;
+        return RELAY_IO_THREAD_ERR_OUT_RING_FULL;
+    }
+
+    RelayIoDatagram* item = relaySpscRingProducerItem(&self->outDatagrams, 0);
+    tc_memcpy_octets(item->octets, data, octetCount);
+    item->octetCount = octetCount;
+    relaySpscRingProducerCommit(&self->outDatagrams, 1);
+    relayIoThreadWake(self);
+
+    return 0;
+}
+
+static ssize_t relayIoThreadTransportReceive(void* _self, uint8_t* data, size_t octetCount)
+{
+    (void) _self;
+    (void) data;
+    (void) octetCount;
+
+    // datagrams are received by the I/O thread into packet pool slots
+    return 0;
+}
+
+/// Transport for the game thread that queues datagrams for the I/O thread to send
+DatagramTransport relayIoThreadTransport(RelayIoThread* self)
+{
+    DatagramTransport transport;
+    transport.self = self;
+    transport.send = relayIoThreadTransportSend;
+    transport.receive = relayIoThreadTransportReceive;
+
+    return transport;
+}
@@ -7,47 +7,174 @@
 #include <flood/out_stream.h>
 #include <relay-client/listener.h>
 
+static size_t relayListenerReadyCapacity(size_t connectionCapacity)
+{
+    size_t capacity = 1;
+    while (capacity < connectionCapacity) {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+static void relayListenerClearConnection(RelayListener* self, RelayConnection* connection)
+{
+    // the connection can still be in readyConnections, it is skipped there since the queue is empty
+    self->queuedPacketCount -= relayPacketQueueCount(&connection->inQueue);
+    relayPacketQueueClear(&connection->inQueue, self->pool);
+    connection->connectionId = 0;
+    relayPacketHeaderInit(&connection->header, self->userSessionId, 0);
+    connection->dropStats.droppedPacketCount = 0;
+    connection->dropStats.droppedOctetCount = 0;
+    tc_mem_clear_type(&connection->traffic);
+    connection->inQueueHighWater = 0;
+}
+
+/// Allocates the connections, their queues and the ready ring as one buffer, so they are only
+/// held while the listener is in use
+static void relayListenerAllocateBuffer(RelayListener* self)
+{
+    uint8_t* buffer = relayBufferPoolAlloc(self->bufferPool);
+    self->connections = (void*) buffer;
+
+    RelayPacketRef* refs = (void*) (buffer + self->connectionCapacity * sizeof(RelayConnection));
+    for (size_t i = 0; i < self->connectionCapacity; ++i) {
+        RelayConnection* connection = &self->connections[i];
+        relayPacketQueueInit(&connection->inQueue, refs + i * self->connectionQueueCapacity,
+                             self->connectionQueueCapacity);
+        relayListenerClearConnection(self, connection);
+        connection->isReady = false;
+    }
+
+    self->readyConnections = (uint8_t*) (refs + self->connectionCapacity * self->connectionQueueCapacity);
+    self->readyHead = 0;
+    self->readyTail = 0;
+}
+
+static void relayListenerClearAllConnections(RelayListener* self)
+{
+    for (size_t i = 0; i < self->connectionCapacity; ++i) {
+        relayListenerClearConnection(self, &self->connections[i]);
+        self->connections[i].isReady = false;
+    }
+    self->readyHead = 0;
+    self->readyTail = 0;
+}
+
+static void relayListenerCountOut(RelayListener* self, size_t connectionIndex, size_t octetCount)
+{
+    relayTrafficStatsAddOut(&self->connections[connectionIndex].traffic, octetCount);
+    relayTrafficStatsAddOut(&self->traffic, octetCount);
+}
+
 void relayListenerReInit(RelayListener* self, const RelayListenerSetup* setup)
 {
-    self->transportToRelayServer = setup->transportToRelayServer;
+    self->socket = setup->socket;
     self->userSessionId = setup->authenticatedUserSessionId;
     CLOG_ASSERT(self->userSessionId != 0, "User session id can not be zero")
     self->applicationId = setup->applicationId;
     self->channelId = setup->channelId;
+    self->requestId = setup->requestId;
     self->state = RelayListenerStateConnecting;
-    self->waitTime = 0;
+    self->lastError = 0;
+    relayHandshakeCompletionClear(&self->completion);
+    uint64_t retrySeed = self->userSessionId ^ ((uint64_t) self->applicationId << 32) ^ self->channelId;
+    relayRetryInit(&self->retry, &setup->retry, retrySeed);
+
+    if (self->connections == 0) {
+        relayListenerAllocateBuffer(self);
+    } else {
+        relayListenerClearAllConnections(self);
+    }
+}
+
+/// The octet count of the buffer a listener needs while it is active
+size_t relayListenerBufferOctetCount(size_t connectionCapacity, size_t connectionQueueCapacity)
+{
+    return connectionCapacity * sizeof(RelayConnection) +
+           connectionCapacity * connectionQueueCapacity * sizeof(RelayPacketRef) +
+           relayListenerReadyCapacity(connectionCapacity);
+}
+
+/// Hands out the next received packet without copying it. Connections with pending packets take turns,
+/// so a connection that floods the listener can not starve the others.
+/// The payload stays valid until relayListenerReleasePacket() is called for it.
+/// @return 1 if a packet was borrowed, 0 if there are no packets
+int relayListenerBorrowPacket(RelayListener* self, RelayReceivedPacket* outPacket)
+{
+    size_t readyMask = self->readyCapacity - 1;
+
+    while (self->readyHead != self->readyTail) {
+        uint8_t connectionIndex = self->readyConnections[self->readyHead & readyMask];
+        self->readyHead++;
+
+        RelayConnection* connection = &self->connections[connectionIndex];
+        RelayPacketRef ref;
+        if (!relayPacketQueuePop(&connection->inQueue, &ref)) {
+            connection->isReady = false;
+            continue;
+        }
+        self->queuedPacketCount--;
+
+        if (relayPacketQueueCount(&connection->inQueue) > 0) {
+            // back of the line
+            self->readyConnections[self->readyTail & readyMask] = connectionIndex;
+            self->readyTail++;
+        } else {
+            connection->isReady = false;
+        }
+
+#if defined RELAY_CLIENT_LATENCY_TRACING
+        uint32_t nowMs = (uint32_t) monotonicTimeMsNow();
+        relayLatencyHistogramAdd(&self->residency, nowMs - ref.queuedAtMs);
+        relayLatencyHistogramAdd(&self->dispatchLatency, nowMs - ref.receivedAtMs);
+#endif
+
+        outPacket->octets = relayPacketPoolSlotOctets(self->pool, ref.slotIndex) + ref.octetOffset;
+        outPacket->octetCount = ref.octetCount;
+        outPacket->connectionIndex = connectionIndex;
+        outPacket->slotIndex = ref.slotIndex;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+void relayListenerReleasePacket(RelayListener* self, const RelayReceivedPacket* packet)
+{
+    relayPacketPoolFree(self->pool, packet->slotIndex);
 }
 
 ssize_t relayListenerReceivePacket(RelayListener* self, uint8_t* outConnectionIndex, uint8_t* octets,
                                    size_t maxOctetCount)
 {
-    size_t count = discoidBufferReadAvailable(&self->inBuffer);
-    if (count < 1) {
+    RelayReceivedPacket packet;
+    if (relayListenerBorrowPacket(self, &packet) == 0) {
         return 0;
     }
 
-    discoidBufferRead(&self->inBuffer, outConnectionIndex, sizeof(uint8_t));
-
-    RelaySerializeConnectionId connectionId;
-    discoidBufferRead(&self->inBuffer, (uint8_t*) &connectionId, sizeof(connectionId));
-
-    uint16_t followingOctets;
-    discoidBufferRead(&self->inBuffer, (uint8_t*) &followingOctets, sizeof(followingOctets));
+    *outConnectionIndex = packet.connectionIndex;
 
-    if (maxOctetCount < followingOctets) {
-        CLOG_C_SOFT_ERROR(&self->log, "can not read incoming packet from circular buffer")
-        discoidBufferSkip(&self->inBuffer, followingOctets);
+    if (maxOctetCount < packet.octetCount) {
+        CLOG_C_SOFT_ERROR(&self->log, "can not read incoming packet from queue")
+        relayListenerReleasePacket(self, &packet);
         return -2;
     }
 
-    discoidBufferRead(&self->inBuffer, octets, followingOctets);
+    tc_memcpy_octets(octets, packet.octets, packet.octetCount);
+    relayListenerReleasePacket(self, &packet);
 
-    return followingOctets;
+    return (ssize_t) packet.octetCount;
 }
 
 ssize_t relayListenerFindFreeConnectionIndex(RelayListener* self)
 {
-    for (size_t i = 0; i < RELAY_CLIENT_MAX_LISTENER_CONNECTIONS_COUNT; ++i) {
+    if (self->connections == 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < self->connectionCapacity; ++i) {
         if (self->connections[i].connectionId == 0) {
             return (ssize_t) i;
         }
@@ -58,7 +185,11 @@ ssize_t relayListenerFindFreeConnectionIndex(RelayListener* self)
 
 RelayConnection* relayListenerFindConnection(RelayListener* self, RelaySerializeConnectionId connectionId)
 {
-    for (size_t i = 0; i < RELAY_CLIENT_MAX_LISTENER_CONNECTIONS_COUNT; ++i) {
+    if (self->connections == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < self->connectionCapacity; ++i) {
         if (self->connections[i].connectionId == connectionId) {
             return &self->connections[i];
         }
@@ -67,20 +198,65 @@ RelayConnection* relayListenerFindConnection(RelayListener* self, RelaySerialize
     return 0;
 }
 
+/// Occupies a free connection index for connectionId. The connection gets a new generation, so handles
+/// to earlier connections on the same index are rejected.
+void relayListenerAddConnection(RelayListener* self, size_t connectionIndex, RelaySerializeConnectionId connectionId,
+                                MonotonicTimeMs now)
+{
+    RelayConnection* connection = &self->connections[connectionIndex];
+    CLOG_ASSERT(connection->connectionId == 0, "connection index %zu is already in use", connectionIndex)
+
+    connection->connectionId = connectionId;
+    relayPacketHeaderInit(&connection->header, self->userSessionId, connectionId);
+    connection->generation = self->nextGeneration++;
+    if (self->nextGeneration == 0) {
+        self->nextGeneration = 1;
+    }
+    connection->lastReceivedAt = now;
+}
+
+/// Releases the queued packets for the connection and frees the index for new connections
+void relayListenerRemoveConnection(RelayListener* self, size_t connectionIndex)
+{
+    relayListenerClearConnection(self, &self->connections[connectionIndex]);
+}
+
+RelayConnectionHandle relayListenerConnectionHandle(const RelayListener* self, size_t connectionIndex)
+{
+    return ((RelayConnectionHandle) self->connections[connectionIndex].generation << 8) |
+           (RelayConnectionHandle) connectionIndex;
+}
+
+/// @return the connection index, or negative if the handle is stale or illegal
+ssize_t relayListenerConnectionIndexFromHandle(const RelayListener* self, RelayConnectionHandle handle)
+{
+    size_t connectionIndex = handle & 0xff;
+    if (self->connections == 0 || connectionIndex >= self->connectionCapacity) {
+        return -1;
+    }
+
+    const RelayConnection* connection = &self->connections[connectionIndex];
+    if (connection->connectionId == 0 || connection->generation != (uint16_t) (handle >> 8)) {
+        return -1;
+    }
+
+    return (ssize_t) connectionIndex;
+}
+
 static int sendListenRequest(RelayListener* self, FldOutStream* outStream)
 {
     CLOG_C_DEBUG(&self->log, "send listen request")
     RelaySerializeListenRequestFromClientToServer data;
     data.channelId = self->channelId;
     data.appId = self->applicationId;
-    data.requestId = ++self->requestId;
+    data.requestId = self->requestId;
     return relaySerializeClientOutRequestListen(outStream, self->userSessionId, &data);
 }
 
 static int relayListenerSendHandshakePacket(RelayListener* self)
 {
     FldOutStream outStream;
-    fldOutStreamInit(&outStream, self->tempBuffer, DATAGRAM_TRANSPORT_MAX_SIZE);
+    fldOutStreamInit(&outStream, self->socket->scratchBuf, DATAGRAM_TRANSPORT_MAX_SIZE);
 
     int result = 0;
     switch (self->state) {
@@ -100,19 +276,25 @@ static int relayListenerSendHandshakePacket(RelayListener* self)
         return 0;
     }
 
-    return datagramTransportSend(&self->transportToRelayServer, outStream.octets, outStream.pos);
+    return relaySocketSendDatagram(self->socket, outStream.octets, outStream.pos);
 }
 
 static int relayListenerUpdateOut(RelayListener* self, MonotonicTimeMs now)
 {
-    (void) now;
-
-    if (self->waitTime > 0) {
-        self->waitTime--;
-        return 0;
+    switch (relayRetryUpdate(&self->retry, now)) {
+        case RelayRetryActionWait:
+            return 0;
+        case RelayRetryActionTimedOut:
+            CLOG_C_NOTICE(&self->log, "no listen response after %zu attempts, giving up", self->retry.attemptCount)
+            relayListenerAbortHandshake(self, RELAY_RETRY_ERR_TIMED_OUT, RelayHandshakeResultTimedOut);
+            return RELAY_RETRY_ERR_TIMED_OUT;
+        case RelayRetryActionSend:
+            break;
     }
 
-    self->waitTime = 5;
+    if (self->retry.attemptCount > 1) {
+        self->handshakeRetryCount++;
+    }
 
     return relayListenerSendHandshakePacket(self);
 }
@@ -129,14 +311,23 @@ static int multiTransportSend(void* _self, int connectionIndex, const uint8_t* d
 
     CLOG_C_DEBUG(&self->log, "sending to relay: connection:%d octetCount:%zu", connectionIndex, size)
 
-    if (connectionIndex < 0 || connectionIndex >= RELAY_CLIENT_MAX_LISTENER_CONNECTIONS_COUNT) {
-        CLOG_C_ERROR(&self->log, "illegal index %d", connectionIndex)
+    if (self->connections == 0 || connectionIndex < 0 || (size_t) connectionIndex >= self->connectionCapacity) {
+        CLOG_C_SOFT_ERROR(&self->log, "illegal index %d", connectionIndex)
+        return -4;
     }
 
     RelayConnection* connection = &self->connections[connectionIndex];
+    if (connection->connectionId == 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "can not send on index with no connection")
+        return -5;
+    }
 
-    return relaySocketSendPacket(self->transportToRelayServer, self->userSessionId, connection->connectionId, data,
-                                 size);
+    int result = relaySocketSendPacketWithHeader(self->socket, &connection->header, data, size);
+    if (result >= 0) {
+        relayListenerCountOut(self, (size_t) connectionIndex, size);
+    }
+
+    return result;
 }
 
 static ssize_t multiTransportReceive(void* _self, int* receivedFromConnectionIndex, uint8_t* data, size_t size)
@@ -158,77 +349,322 @@ static ssize_t multiTransportReceive(void* _self, int* receivedFromConnectionInd
     return octetCount;
 }
 
-int relayListenerInit(RelayListener* self, struct ImprintAllocator* memory, const char* prefix, Clog log)
+int relayListenerInit(RelayListener* self, RelayPacketPool* pool, RelayBufferPool* bufferPool,
+                      size_t connectionCapacity, size_t connectionQueueCapacity, const char* prefix, Clog log)
 {
     self->log = log;
     tc_strncpy(self->prefix, 32, prefix, tc_strlen(prefix));
     self->log.constantPrefix = self->prefix;
 
     self->state = RelayListenerStateIdle;
-    discoidBufferInit(&self->inBuffer, memory, 32 * 1024);
+    self->socket = 0;
+    self->listenerId = 0;
+    self->requestId = 0;
+    self->pool = pool;
+    self->bufferPool = bufferPool;
+    self->connectionCapacity = connectionCapacity;
+    self->connectionQueueCapacity = connectionQueueCapacity;
+    self->nextGeneration = 1;
+    self->connections = 0;
+    self->overflowPolicy = RelayPacketOverflowPolicyDropNewest;
+    self->dropStats.droppedPacketCount = 0;
+    self->dropStats.droppedOctetCount = 0;
+    tc_mem_clear_type(&self->traffic);
+    self->inQueueHighWater = 0;
+    self->queuedPacketCount = 0;
+    self->handshakeRetryCount = 0;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    tc_mem_clear_type(&self->residency);
+    tc_mem_clear_type(&self->dispatchLatency);
+#endif
+    self->reservedConnectionIndex = 0;
+    self->readyConnections = 0;
+    self->readyCapacity = relayListenerReadyCapacity(connectionCapacity);
+    self->readyHead = 0;
+    self->readyTail = 0;
 
     self->multiTransport.self = self;
     self->multiTransport.sendTo = multiTransportSend;
     self->multiTransport.receiveFrom = multiTransportReceive;
 
-    for (size_t i = 0; i < RELAY_CLIENT_MAX_LISTENER_CONNECTIONS_COUNT; ++i) {
-        self->connections[i].connectionId = 0;
-    }
-
-    self->waitTime = 0;
+    self->lastError = 0;
+    relayHandshakeCompletionClear(&self->completion);
 
     return 0;
 }
 
 void relayListenerDestroy(RelayListener* self)
 {
-    (void) self;
+    relayListenerDisconnect(self);
+}
+
+/// Calls the completion when the handshake succeeds, times out, is rejected or is cancelled.
+/// If the handshake is already over, it is called at once.
+void relayListenerSetCompletion(RelayListener* self, RelayHandshakeCompletion completion)
+{
+    self->completion = completion;
+
+    switch (self->state) {
+        case RelayListenerStateConnecting:
+            break;
+        case RelayListenerStateConnected:
+            relayHandshakeCompletionDeliver(&self->completion, RelayHandshakeResultSucceeded);
+            break;
+        case RelayListenerStateIdle:
+            relayHandshakeCompletionDeliver(&self->completion, relayHandshakeResultFromError(self->lastError));
+            break;
+    }
+}
+
+/// Disconnects and reports the result, instead of the cancel that relayListenerDisconnect() reports
+void relayListenerAbortHandshake(RelayListener* self, int error, RelayHandshakeResult result)
+{
+    RelayHandshakeCompletion completion = self->completion;
+    relayHandshakeCompletionClear(&self->completion);
+
+    relayListenerDisconnect(self);
+    self->lastError = error;
+
+    relayHandshakeCompletionDeliver(&completion, result);
 }
 
+/// Stops the listener and returns its buffers to the buffer pool
 void relayListenerDisconnect(RelayListener* self)
 {
-    (void) self;
+    bool wasConnecting = self->state == RelayListenerStateConnecting;
+
+    if (self->connections != 0) {
+        relayListenerClearAllConnections(self);
+        relayBufferPoolFree(self->bufferPool, self->connections);
+        self->connections = 0;
+        self->readyConnections = 0;
+    }
+
+    self->state = RelayListenerStateIdle;
+    self->listenerId = 0;
+
+    if (wasConnecting) {
+        relayHandshakeCompletionDeliver(&self->completion, RelayHandshakeResultCancelled);
+    }
 }
 
-ssize_t relayListenerPushPacket(RelayListener* self, size_t relayConnectionIndex, const uint8_t* data,
-                                size_t octetCountInPacket)
+/// Queues a packet that is already in a pool slot. Ownership of the slot moves to the listener.
+ssize_t relayListenerPushPacketRef(RelayListener* self, const RelayPacketRef* ref)
 {
-    if (discoidBufferWriteAvailable(&self->inBuffer) < octetCountInPacket + sizeof(RelaySerializeConnectionId) + 2) {
-        CLOG_C_NOTICE(&self->log, "dropping packets since in buffer is full")
+    if (ref->connectionIndex >= self->connectionCapacity) {
+        CLOG_C_ERROR(&self->log, "illegal index %hu", ref->connectionIndex)
+        // return -4;
+    }
+
+    RelayConnection* connection = &self->connections[ref->connectionIndex];
+    relayTrafficStatsAddIn(&connection->traffic, ref->octetCount);
+    relayTrafficStatsAddIn(&self->traffic, ref->octetCount);
+
+    RelayPacketDropStats before = connection->dropStats;
+    size_t queuedCountBefore = relayPacketQueueCount(&connection->inQueue);
+    bool wasQueued = relayPacketQueuePushWithPolicy(&connection->inQueue, self->pool, ref, self->overflowPolicy,
+                                                    &connection->dropStats);
+    self->queuedPacketCount = self->queuedPacketCount - queuedCountBefore + relayPacketQueueCount(&connection->inQueue);
+    size_t droppedCount = connection->dropStats.droppedPacketCount - before.droppedPacketCount;
+    if (droppedCount > 0) {
+        self->dropStats.droppedPacketCount += droppedCount;
+        self->dropStats.droppedOctetCount += connection->dropStats.droppedOctetCount - before.droppedOctetCount;
+        if (self->overflowPolicy != RelayPacketOverflowPolicyKeepLatest) {
+            CLOG_C_NOTICE(&self->log, "dropped %zu packets since in queue for connection index %hu is full",
+                          droppedCount, ref->connectionIndex)
+        }
+    }
+
+    if (!wasQueued) {
         return 0;
     }
 
-    if (relayConnectionIndex >= RELAY_CLIENT_MAX_LISTENER_CONNECTIONS_COUNT) {
-        CLOG_ERROR("illegal index %zd", relayConnectionIndex)
-        // return -4;
+    size_t queuedCount = relayPacketQueueCount(&connection->inQueue);
+    if (queuedCount > connection->inQueueHighWater) {
+        connection->inQueueHighWater = queuedCount;
+        if (queuedCount > self->inQueueHighWater) {
+            self->inQueueHighWater = queuedCount;
+        }
+    }
+
+    if (!connection->isReady) {
+        connection->isReady = true;
+        self->readyConnections[self->readyTail & (self->readyCapacity - 1)] = (uint8_t) ref->connectionIndex;
+        self->readyTail++;
     }
 
-    RelayConnection* connection = &self->connections[relayConnectionIndex];
+    return ref->octetCount;
+}
+
+ssize_t relayListenerPushPacket(RelayListener* self, size_t relayConnectionIndex, const uint8_t* data,
+                                size_t octetCountInPacket)
+{
+    if (octetCountInPacket > RELAY_PACKET_SLOT_OCTET_COUNT) {
+        CLOG_C_SOFT_ERROR(&self->log, "packet is too big %zu", octetCountInPacket)
+        return -2;
+    }
+
+    RelayPacketRef ref;
+    if (relayPacketPoolAlloc(self->pool, &ref.slotIndex) < 0) {
+        CLOG_C_NOTICE(&self->log, "dropping packets since packet pool is exhausted")
+        return 0;
+    }
 
-    uint8_t connectionIndexOctet = (uint8_t) relayConnectionIndex;
-    discoidBufferWrite(&self->inBuffer, (uint8_t*) &connectionIndexOctet, sizeof(connectionIndexOctet));
-    discoidBufferWrite(&self->inBuffer, (uint8_t*) &connection->connectionId, sizeof(RelaySerializeConnectionId));
-    discoidBufferWrite(&self->inBuffer, (uint8_t*) &octetCountInPacket, 2);
-    discoidBufferWrite(&self->inBuffer, data, octetCountInPacket);
+    tc_memcpy_octets(relayPacketPoolSlotOctets(self->pool, ref.slotIndex), data, octetCountInPacket);
+    ref.octetOffset = 0;
+    ref.octetCount = (uint16_t) octetCountInPacket;
+    ref.connectionIndex = (uint16_t) relayConnectionIndex;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    ref.receivedAtMs = (uint32_t) monotonicTimeMsNow();
+    ref.queuedAtMs = ref.receivedAtMs;
+#endif
 
-    return (ssize_t) octetCountInPacket;
+    return relayListenerPushPacketRef(self, &ref);
 }
 
 ssize_t relayListenerSendToConnectionIndex(RelayListener* self, size_t connectionIndex, const uint8_t* data,
                                            size_t octetCount)
 {
-    if (connectionIndex >= RELAY_CLIENT_MAX_LISTENER_CONNECTIONS_COUNT) {
-        CLOG_ERROR("illegal index %zd", connectionIndex)
-        // return -4;
+    if (self->connections == 0 || connectionIndex >= self->connectionCapacity) {
+        CLOG_C_SOFT_ERROR(&self->log, "illegal index %zu", connectionIndex)
+        return -4;
     }
 
     RelayConnection* connection = &self->connections[connectionIndex];
     if (connection->connectionId == 0) {
-        CLOG_ERROR("can not send on index with no connection")
+        CLOG_C_SOFT_ERROR(&self->log, "can not send on index with no connection")
+        return -5;
     }
 
     CLOG_C_DEBUG(&self->log, "sending packet on connection index %zu", connectionIndex)
 
-    return relaySocketSendPacket(self->transportToRelayServer, self->userSessionId, connection->connectionId, data,
-                                 octetCount);
+    int result = relaySocketSendPacketWithHeader(self->socket, &connection->header, data, octetCount);
+    if (result >= 0) {
+        relayListenerCountOut(self, connectionIndex, octetCount);
+    }
+
+    return result;
+}
+
+static int relayListenerBroadcastBatch(RelayListener* self, const size_t* connectionIndices,
+                                       const RelayPacketHeader* const* headers, size_t count, const uint8_t* data,
+                                       size_t octetCount)
+{
+    int result = relaySocketSendPacketToMany(self->socket, headers, count, data, octetCount);
+    if (result < 0) {
+        return result;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        relayListenerCountOut(self, connectionIndices[i], octetCount);
+    }
+
+    return 0;
+}
+
+/// Sends the same packet to every connection in connectionMask, where bit n is connection index n, or to all
+/// connections with RELAY_LISTENER_BROADCAST_ALL. The payload is only copied once per batch, every datagram gets
+/// the cached header of its connection.
+/// @return the number of connections the packet was sent to, or negative on error
+ssize_t relayListenerBroadcast(RelayListener* self, uint64_t connectionMask, const uint8_t* data, size_t octetCount)
+{
+    if (self->connections == 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "can not broadcast on a listener that is not started")
+        return -1;
+    }
+
+    size_t connectionIndices[RELAY_LISTENER_BROADCAST_BATCH_COUNT];
+    const RelayPacketHeader* headers[RELAY_LISTENER_BROADCAST_BATCH_COUNT];
+    size_t batchCount = 0;
+    size_t sentCount = 0;
+
+    for (size_t i = 0; i < self->connectionCapacity; ++i) {
+        if (connectionMask != RELAY_LISTENER_BROADCAST_ALL && (i >= 64 || (connectionMask & (1ull << i)) == 0)) {
+            continue;
+        }
+
+        const RelayConnection* connection = &self->connections[i];
+        if (connection->connectionId == 0) {
+            continue;
+        }
+
+        connectionIndices[batchCount] = i;
+        headers[batchCount] = &connection->header;
+        batchCount++;
+
+        if (batchCount == RELAY_LISTENER_BROADCAST_BATCH_COUNT) {
+            int batchErr = relayListenerBroadcastBatch(self, connectionIndices, headers, batchCount, data,
+                                                       octetCount);
+            if (batchErr < 0) {
+                return batchErr;
+            }
+            sentCount += batchCount;
+            batchCount = 0;
+        }
+    }
+
+    if (batchCount > 0) {
+        int batchErr = relayListenerBroadcastBatch(self, connectionIndices, headers, batchCount, data,
+                                                   octetCount);
+        if (batchErr < 0) {
+            return batchErr;
+        }
+        sentCount += batchCount;
+    }
+
+    CLOG_C_DEBUG(&self->log, "broadcast packet of %zu octets to %zu connections", octetCount, sentCount)
+
+    return (ssize_t) sentCount;
+}
+
+/// Returns a pointer inside the outgoing datagram to the connection, directly after the relay header, where the
+/// payload can be serialized. Must be followed by relayListenerCommit() before anything else is sent.
+uint8_t* relayListenerReserve(RelayListener* self, size_t connectionIndex, size_t* outMaxOctetCount)
+{
+    if (self->connections == 0 || connectionIndex >= self->connectionCapacity) {
+        CLOG_C_SOFT_ERROR(&self->log, "illegal index %zu", connectionIndex)
+        *outMaxOctetCount = 0;
+        return 0;
+    }
+
+    RelayConnection* connection = &self->connections[connectionIndex];
+    if (connection->connectionId == 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "can not send on index with no connection")
+        *outMaxOctetCount = 0;
+        return 0;
+    }
+
+    self->reservedConnectionIndex = connectionIndex;
+
+    return relaySocketReservePacketWithHeader(self->socket, &connection->header, outMaxOctetCount);
+}
+
+int relayListenerCommit(RelayListener* self, size_t octetCount)
+{
+    CLOG_C_DEBUG(&self->log, "sending reserved packet %zu", octetCount)
+    int result = relaySocketCommitPacket(self->socket, octetCount);
+    if (result >= 0) {
+        relayListenerCountOut(self, self->reservedConnectionIndex, octetCount);
+    }
+
+    return result;
+}
+
+/// Selects what happens to packets arriving for a connection whose in queue is full.
+/// Dropped packets are counted in dropStats, both for the listener and for each connection.
+void relayListenerSetOverflowPolicy(RelayListener* self, RelayPacketOverflowPolicy policy)
+{
+    self->overflowPolicy = policy;
+}
+
+ssize_t relayListenerSendToConnectionHandle(RelayListener* self, RelayConnectionHandle handle, const uint8_t* data,
+                                            size_t octetCount)
+{
+    ssize_t connectionIndex = relayListenerConnectionIndexFromHandle(self, handle);
+    if (connectionIndex < 0) {
+        CLOG_C_NOTICE(&self->log, "can not send on stale connection handle %08X", handle)
+        return -3;
+    }
+
+    return relayListenerSendToConnectionIndex(self, (size_t) connectionIndex, data, octetCount);
 }
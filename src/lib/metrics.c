@@ -0,0 +1,276 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <inttypes.h>
+#include <relay-client/metrics.h>
+#include <tiny-libc/tiny_libc.h>
+
+static void addTraffic(RelayTrafficStats* target, const RelayTrafficStats* source)
+{
+    target->packetsIn += source->packetsIn;
+    target->octetsIn += source->octetsIn;
+    target->packetsOut += source->packetsOut;
+    target->octetsOut += source->octetsOut;
+}
+
+static void addDrops(RelayPacketDropStats* target, const RelayPacketDropStats* source)
+{
+    target->droppedPacketCount += source->droppedPacketCount;
+    target->droppedOctetCount += source->droppedOctetCount;
+}
+
+void relayClientMetricsSnapshot(const RelayClient* self, RelayClientMetrics* outMetrics)
+{
+    tc_mem_clear_type(outMetrics);
+
+    outMetrics->client = self->stats;
+    outMetrics->socket = self->socket.stats;
+    outMetrics->earlyArrivals = self->earlyArrivals.stats;
+    outMetrics->pendingRequests = self->pendingRequests.stats;
+    outMetrics->pendingRequestCount = self->pendingRequests.count;
+    outMetrics->packetPoolSlotCount = self->packetPool.slotCount;
+    outMetrics->packetPoolFreeCount = self->packetPool.freeCount;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    outMetrics->sendLatency = self->socket.sendLatency;
+#endif
+
+    for (size_t i = 0; i < self->listenerCapacity; ++i) {
+        const RelayListener* listener = &self->listeners[i];
+        addTraffic(&outMetrics->listenerTraffic, &listener->traffic);
+        addDrops(&outMetrics->listenerDrops, &listener->dropStats);
+        outMetrics->handshakeRetryCount += listener->handshakeRetryCount;
+        if (listener->inQueueHighWater > outMetrics->inQueueHighWater) {
+            outMetrics->inQueueHighWater = listener->inQueueHighWater;
+        }
+#if defined RELAY_CLIENT_LATENCY_TRACING
+        relayLatencyHistogramMerge(&outMetrics->residency, &listener->residency);
+        relayLatencyHistogramMerge(&outMetrics->dispatchLatency, &listener->dispatchLatency);
+#endif
+        if (listener->state == RelayListenerStateIdle || listener->connections == 0) {
+            continue;
+        }
+        outMetrics->activeListenerCount++;
+        for (size_t connectionIndex = 0; connectionIndex < listener->connectionCapacity; ++connectionIndex) {
+            if (listener->connections[connectionIndex].connectionId != 0) {
+                outMetrics->activeConnectionCount++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < self->connectorCapacity; ++i) {
+        const RelayConnector* connector = &self->connectors[i];
+        addTraffic(&outMetrics->connectorTraffic, &connector->traffic);
+        addDrops(&outMetrics->connectorDrops, &connector->dropStats);
+        outMetrics->handshakeRetryCount += connector->handshakeRetryCount;
+        if (connector->inQueueHighWater > outMetrics->inQueueHighWater) {
+            outMetrics->inQueueHighWater = connector->inQueueHighWater;
+        }
+#if defined RELAY_CLIENT_LATENCY_TRACING
+        relayLatencyHistogramMerge(&outMetrics->residency, &connector->residency);
+        relayLatencyHistogramMerge(&outMetrics->dispatchLatency, &connector->dispatchLatency);
+#endif
+        if (connector->state != RelayConnectorStateIdle) {
+            outMetrics->activeConnectorCount++;
+        }
+    }
+}
+
+typedef struct RelayMetricsWriter {
+    char* target;
+    size_t maxOctetCount;
+    size_t pos;
+    bool isOverflow;
+} RelayMetricsWriter;
+
+static void relayMetricsWriterAdvance(RelayMetricsWriter* self, int octetCount)
+{
+    if (octetCount < 0 || (size_t) octetCount >= self->maxOctetCount - self->pos) {
+        self->isOverflow = true;
+        return;
+    }
+
+    self->pos += (size_t) octetCount;
+}
+
+static void writeType(RelayMetricsWriter* self, const char* name, const char* type)
+{
+    if (self->isOverflow) {
+        return;
+    }
+
+    relayMetricsWriterAdvance(self, tc_snprintf(self->target + self->pos, self->maxOctetCount - self->pos,
+                                                "# TYPE relay_client_%s %s\n", name, type));
+}
+
+static void writeValue(RelayMetricsWriter* self, const char* name, uint64_t value)
+{
+    if (self->isOverflow) {
+        return;
+    }
+
+    relayMetricsWriterAdvance(self, tc_snprintf(self->target + self->pos, self->maxOctetCount - self->pos,
+                                                "relay_client_%s %" PRIu64 "\n", name, value));
+}
+
+static void writeMetric(RelayMetricsWriter* self, const char* name, const char* type, uint64_t value)
+{
+    writeType(self, name, type);
+    writeValue(self, name, value);
+}
+
+static void writeIndexedValue(RelayMetricsWriter* self, const char* name, const char* labelName, size_t index,
+                              uint64_t value)
+{
+    if (self->isOverflow) {
+        return;
+    }
+
+    relayMetricsWriterAdvance(self, tc_snprintf(self->target + self->pos, self->maxOctetCount - self->pos,
+                                                "relay_client_%s{%s=\"%zu\"} %" PRIu64 "\n", name, labelName, index,
+                                                value));
+}
+
+#if defined RELAY_CLIENT_LATENCY_TRACING
+static void writeHistogram(RelayMetricsWriter* self, const char* name, const RelayLatencyHistogram* histogram)
+{
+    writeType(self, name, "histogram");
+
+    size_t cumulativeCount = 0;
+    for (size_t i = 0; i < RELAY_LATENCY_HISTOGRAM_BUCKET_COUNT - 1 && !self->isOverflow; ++i) {
+        cumulativeCount += histogram->bucketCounts[i];
+        relayMetricsWriterAdvance(self, tc_snprintf(self->target + self->pos, self->maxOctetCount - self->pos,
+                                                    "relay_client_%s_bucket{le=\"%" PRIu32 "\"} %zu\n", name,
+                                                    relayLatencyHistogramBucketUpperBound(i), cumulativeCount));
+    }
+
+    if (self->isOverflow) {
+        return;
+    }
+
+    relayMetricsWriterAdvance(self, tc_snprintf(self->target + self->pos, self->maxOctetCount - self->pos,
+                                                "relay_client_%s_bucket{le=\"+Inf\"} %zu\n"
+                                                "relay_client_%s_sum %" PRIu64 "\n"
+                                                "relay_client_%s_count %zu\n",
+                                                name, histogram->sampleCount, name, histogram->totalMs, name,
+                                                histogram->sampleCount));
+}
+#endif
+
+static void writeListeners(RelayMetricsWriter* writer, const RelayClient* self)
+{
+    static const char* names[] = {
+        "listener_packets_in_total",
+        "listener_octets_in_total",
+        "listener_packets_out_total",
+        "listener_octets_out_total",
+        "listener_dropped_packets_total",
+        "listener_handshake_retries_total",
+        "listener_in_queue_high_water",
+    };
+    static const size_t nameCount = sizeof(names) / sizeof(names[0]);
+
+    for (size_t nameIndex = 0; nameIndex < nameCount; ++nameIndex) {
+        writeType(writer, names[nameIndex], nameIndex + 1 == nameCount ? "gauge" : "counter");
+        for (size_t i = 0; i < self->listenerCapacity; ++i) {
+            const RelayListener* listener = &self->listeners[i];
+            if (listener->state == RelayListenerStateIdle) {
+                continue;
+            }
+            size_t values[] = {listener->traffic.packetsIn,  listener->traffic.octetsIn,
+                               listener->traffic.packetsOut, listener->traffic.octetsOut,
+                               listener->dropStats.droppedPacketCount, listener->handshakeRetryCount,
+                               listener->inQueueHighWater};
+            writeIndexedValue(writer, names[nameIndex], "listener", i, values[nameIndex]);
+        }
+    }
+}
+
+static void writeConnectors(RelayMetricsWriter* writer, const RelayClient* self)
+{
+    static const char* names[] = {
+        "connector_packets_in_total",
+        "connector_octets_in_total",
+        "connector_packets_out_total",
+        "connector_octets_out_total",
+        "connector_dropped_packets_total",
+        "connector_handshake_retries_total",
+        "connector_in_queue_high_water",
+    };
+    static const size_t nameCount = sizeof(names) / sizeof(names[0]);
+
+    for (size_t nameIndex = 0; nameIndex < nameCount; ++nameIndex) {
+        writeType(writer, names[nameIndex], nameIndex + 1 == nameCount ? "gauge" : "counter");
+        for (size_t i = 0; i < self->connectorCapacity; ++i) {
+            const RelayConnector* connector = &self->connectors[i];
+            if (connector->state == RelayConnectorStateIdle) {
+                continue;
+            }
+            size_t values[] = {connector->traffic.packetsIn,  connector->traffic.octetsIn,
+                               connector->traffic.packetsOut, connector->traffic.octetsOut,
+                               connector->dropStats.droppedPacketCount, connector->handshakeRetryCount,
+                               connector->inQueueHighWater};
+            writeIndexedValue(writer, names[nameIndex], "connector", i, values[nameIndex]);
+        }
+    }
+}
+
+/// Writes the metrics in the Prometheus text exposition format. Listeners and connectors that are idle are
+/// left out of the labeled series.
+/// @return number of octets written (excluding the terminating zero), or negative if target is too small
+ssize_t relayClientMetricsWritePrometheus(const RelayClient* self, char* target, size_t maxOctetCount)
+{
+    RelayClientMetrics metrics;
+    relayClientMetricsSnapshot(self, &metrics);
+
+    RelayMetricsWriter writer;
+    writer.target = target;
+    writer.maxOctetCount = maxOctetCount;
+    writer.pos = 0;
+    writer.isOverflow = maxOctetCount == 0;
+
+    writeMetric(&writer, "datagrams_received_total", "counter", metrics.client.datagramsReceived);
+    writeMetric(&writer, "octets_received_total", "counter", metrics.client.octetsReceived);
+    writeMetric(&writer, "datagrams_sent_total", "counter", metrics.socket.datagramsSent);
+    writeMetric(&writer, "octets_sent_total", "counter", metrics.socket.octetsSent);
+    writeMetric(&writer, "send_errors_total", "counter", metrics.socket.sendErrorCount);
+    writeMetric(&writer, "coalesced_packets_total", "counter", metrics.socket.coalescedPacketCount);
+    writeMetric(&writer, "deserialize_errors_total", "counter", metrics.client.deserializeErrorCount);
+    writeMetric(&writer, "unknown_connection_drops_total", "counter", metrics.client.unknownConnectionDropCount);
+    writeMetric(&writer, "pool_exhausted_drops_total", "counter", metrics.client.poolExhaustedDropCount);
+    writeMetric(&writer, "endpoint_quota_drops_total", "counter", metrics.client.endpointQuotaDropCount);
+    writeMetric(&writer, "early_arrivals_held_total", "counter", metrics.earlyArrivals.heldCount);
+    writeMetric(&writer, "early_arrivals_replayed_total", "counter", metrics.earlyArrivals.replayedCount);
+    writeMetric(&writer, "early_arrivals_expired_total", "counter",
+                metrics.earlyArrivals.expiredCount + metrics.earlyArrivals.evictedCount);
+    writeMetric(&writer, "buffer_full_drops_total", "counter",
+                metrics.listenerDrops.droppedPacketCount + metrics.connectorDrops.droppedPacketCount);
+    writeMetric(&writer, "handshake_retries_total", "counter", metrics.handshakeRetryCount);
+    writeMetric(&writer, "handshake_expired_total", "counter", metrics.pendingRequests.expiredCount);
+    writeMetric(&writer, "handshake_unknown_responses_total", "counter", metrics.pendingRequests.unknownResponseCount);
+    writeMetric(&writer, "pending_requests", "gauge", metrics.pendingRequestCount);
+    writeMetric(&writer, "updates_total", "counter", metrics.client.updateCount);
+    writeMetric(&writer, "update_duration_us_total", "counter", metrics.client.totalUpdateDurationUs);
+    writeMetric(&writer, "update_duration_us_max", "gauge", metrics.client.maxUpdateDurationUs);
+    writeMetric(&writer, "in_queue_high_water", "gauge", metrics.inQueueHighWater);
+    writeMetric(&writer, "active_listeners", "gauge", metrics.activeListenerCount);
+    writeMetric(&writer, "active_connectors", "gauge", metrics.activeConnectorCount);
+    writeMetric(&writer, "active_connections", "gauge", metrics.activeConnectionCount);
+    writeMetric(&writer, "packet_pool_slots", "gauge", metrics.packetPoolSlotCount);
+    writeMetric(&writer, "packet_pool_free_slots", "gauge", metrics.packetPoolFreeCount);
+
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    writeHistogram(&writer, "queue_residency_ms", &metrics.residency);
+    writeHistogram(&writer, "dispatch_latency_ms", &metrics.dispatchLatency);
+    writeHistogram(&writer, "send_latency_ms", &metrics.sendLatency);
+#endif
+
+    writeListeners(&writer, self);
+    writeConnectors(&writer, self);
+
+    if (writer.isOverflow) {
+        return -1;
+    }
+
+    return (ssize_t) writer.pos;
+}
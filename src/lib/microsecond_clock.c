@@ -0,0 +1,34 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#if !defined _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <relay-client/microsecond_clock.h>
+#if defined _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+RelayMicroseconds relayMicrosecondClockNow(void)
+{
+#if defined _WIN32
+    static LARGE_INTEGER frequency;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    uint64_t ticks = (uint64_t) counter.QuadPart;
+    uint64_t ticksPerSecond = (uint64_t) frequency.QuadPart;
+    return ticks / ticksPerSecond * 1000000u + ticks % ticksPerSecond * 1000000u / ticksPerSecond;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000u + (uint64_t) now.tv_nsec / 1000u;
+#endif
+}
@@ -0,0 +1,81 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <clog/clog.h>
+#include <imprint/allocator.h>
+#include <relay-client/packet_pool.h>
+
+/// @param maxSlotCount the pool grows up to this number of slots, in chunks, as they are needed
+int relayPacketPoolInit(RelayPacketPool* self, struct ImprintAllocator* memory, size_t maxSlotCount)
+{
+    if (maxSlotCount == 0 || maxSlotCount > UINT16_MAX - RELAY_PACKET_POOL_CHUNK_SLOT_COUNT) {
+        CLOG_ERROR("illegal packet pool slot count %zu", maxSlotCount)
+        // return -1;
+    }
+
+    size_t maxChunkCount = (maxSlotCount + RELAY_PACKET_POOL_CHUNK_SLOT_COUNT - 1) / RELAY_PACKET_POOL_CHUNK_SLOT_COUNT;
+
+    self->chunks = IMPRINT_ALLOC_TYPE_COUNT(memory, uint8_t*, maxChunkCount);
+    self->chunkCount = 0;
+    self->refCounts = IMPRINT_ALLOC_TYPE_COUNT(memory, uint8_t, maxChunkCount * RELAY_PACKET_POOL_CHUNK_SLOT_COUNT);
+    self->freeSlots = IMPRINT_ALLOC_TYPE_COUNT(memory, RelayPacketSlotIndex,
+                                               maxChunkCount * RELAY_PACKET_POOL_CHUNK_SLOT_COUNT);
+    self->freeCount = 0;
+    self->slotCount = 0;
+    self->maxSlotCount = maxChunkCount * RELAY_PACKET_POOL_CHUNK_SLOT_COUNT;
+    self->memory = memory;
+
+    return 0;
+}
+
+static int relayPacketPoolGrow(RelayPacketPool* self)
+{
+    if (self->slotCount >= self->maxSlotCount) {
+        return -1;
+    }
+
+    self->chunks[self->chunkCount++] = IMPRINT_ALLOC(
+        self->memory, RELAY_PACKET_POOL_CHUNK_SLOT_COUNT * RELAY_PACKET_SLOT_OCTET_COUNT, "relay packet pool chunk");
+
+    // hand out the lowest slots first
+    size_t lastSlot = self->slotCount + RELAY_PACKET_POOL_CHUNK_SLOT_COUNT - 1;
+    for (size_t i = 0; i < RELAY_PACKET_POOL_CHUNK_SLOT_COUNT; ++i) {
+        self->freeSlots[self->freeCount++] = (RelayPacketSlotIndex) (lastSlot - i);
+    }
+    self->slotCount += RELAY_PACKET_POOL_CHUNK_SLOT_COUNT;
+
+    return 0;
+}
+
+/// @return zero on success, negative if all slots are in use
+int relayPacketPoolAlloc(RelayPacketPool* self, RelayPacketSlotIndex* outSlotIndex)
+{
+    if (self->freeCount == 0 && relayPacketPoolGrow(self) < 0) {
+        return -1;
+    }
+
+    *outSlotIndex = self->freeSlots[--self->freeCount];
+    self->refCounts[*outSlotIndex] = 1;
+
+    return 0;
+}
+
+/// Adds a reference to an allocated slot, it is returned to the pool when every reference is released
+void relayPacketPoolRetain(RelayPacketPool* self, RelayPacketSlotIndex slotIndex)
+{
+    CLOG_ASSERT(self->refCounts[slotIndex] > 0 && self->refCounts[slotIndex] < UINT8_MAX,
+                "illegal reference count for packet pool slot %hu", slotIndex)
+    self->refCounts[slotIndex]++;
+}
+
+/// Releases a reference to the slot
+void relayPacketPoolFree(RelayPacketPool* self, RelayPacketSlotIndex slotIndex)
+{
+    CLOG_ASSERT(self->refCounts[slotIndex] > 0, "packet pool slot %hu released twice", slotIndex)
+    if (--self->refCounts[slotIndex] > 0) {
+        return;
+    }
+
+    self->freeSlots[self->freeCount++] = slotIndex;
+}
@@ -0,0 +1,88 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <clog/clog.h>
+#include <relay-client/packet_queue.h>
+
+/// A queue with zero capacity and no storage is valid, it is always both empty and full
+void relayPacketQueueInit(RelayPacketQueue* self, RelayPacketRef* refs, size_t capacity)
+{
+    CLOG_ASSERT((capacity & (capacity - 1)) == 0, "packet queue capacity must be a power of two")
+    self->refs = refs;
+    self->capacity = capacity;
+    self->head = 0;
+    self->tail = 0;
+}
+
+/// Releases all queued slots back to the pool
+void relayPacketQueueClear(RelayPacketQueue* self, RelayPacketPool* pool)
+{
+    RelayPacketRef ref;
+    while (relayPacketQueuePop(self, &ref)) {
+        relayPacketPoolFree(pool, ref.slotIndex);
+    }
+    self->head = 0;
+    self->tail = 0;
+}
+
+bool relayPacketQueuePush(RelayPacketQueue* self, const RelayPacketRef* ref)
+{
+    if (self->tail - self->head == self->capacity) {
+        return false;
+    }
+
+    self->refs[self->tail & (self->capacity - 1)] = *ref;
+    self->tail++;
+
+    return true;
+}
+
+bool relayPacketQueuePop(RelayPacketQueue* self, RelayPacketRef* outRef)
+{
+    if (self->tail == self->head) {
+        return false;
+    }
+
+    *outRef = self->refs[self->head & (self->capacity - 1)];
+    self->head++;
+
+    return true;
+}
+
+static void relayPacketQueueDrop(RelayPacketPool* pool, const RelayPacketRef* ref, RelayPacketDropStats* stats)
+{
+    relayPacketPoolFree(pool, ref->slotIndex);
+    stats->droppedPacketCount++;
+    stats->droppedOctetCount += ref->octetCount;
+}
+
+/// Pushes ref and applies the overflow policy. Slots of dropped packets are released to the pool.
+/// @return true if ref was queued, false if it was dropped
+bool relayPacketQueuePushWithPolicy(RelayPacketQueue* self, RelayPacketPool* pool, const RelayPacketRef* ref,
+                                    RelayPacketOverflowPolicy policy, RelayPacketDropStats* stats)
+{
+    RelayPacketRef oldRef;
+
+    switch (policy) {
+        case RelayPacketOverflowPolicyKeepLatest:
+            while (relayPacketQueuePop(self, &oldRef)) {
+                relayPacketQueueDrop(pool, &oldRef, stats);
+            }
+            break;
+        case RelayPacketOverflowPolicyDropOldest:
+            if (self->tail - self->head == self->capacity && relayPacketQueuePop(self, &oldRef)) {
+                relayPacketQueueDrop(pool, &oldRef, stats);
+            }
+            break;
+        case RelayPacketOverflowPolicyDropNewest:
+            break;
+    }
+
+    if (!relayPacketQueuePush(self, ref)) {
+        relayPacketQueueDrop(pool, ref, stats);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,94 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <relay-client/pending_request.h>
+#include <tiny-libc/tiny_libc.h>
+
+void relayPendingRequestsInit(RelayPendingRequests* self)
+{
+    tc_mem_clear_type(self);
+    self->nextRequestId = 1;
+}
+
+/// Hands out a request id that no other pending request is using. Ids are handed out in order, so a late
+/// response to an abandoned request is unlikely to match a newer request.
+/// @return zero on success, negative if every request id is in use
+int relayPendingRequestsAdd(RelayPendingRequests* self, RelayPendingRequestKind kind, size_t ownerIndex,
+                            RelaySerializeRequestId* outRequestId)
+{
+    if (self->count == RELAY_PENDING_REQUEST_CAPACITY - 1) {
+        self->stats.exhaustedCount++;
+        return -1;
+    }
+
+    for (;;) {
+        size_t requestId = self->nextRequestId;
+        self->nextRequestId = requestId + 1 == RELAY_PENDING_REQUEST_CAPACITY ? 1 : requestId + 1;
+
+        RelayPendingRequest* entry = &self->entries[requestId];
+        if (entry->kind != RelayPendingRequestKindNone) {
+            continue;
+        }
+
+        entry->kind = kind;
+        entry->ownerIndex = (uint16_t) ownerIndex;
+        self->count++;
+        self->stats.issuedCount++;
+        *outRequestId = (RelaySerializeRequestId) requestId;
+
+        return 0;
+    }
+}
+
+/// @return the owner index of the pending request, negative if there is no such request
+int relayPendingRequestsFind(const RelayPendingRequests* self, RelaySerializeRequestId requestId,
+                             RelayPendingRequestKind kind)
+{
+    const RelayPendingRequest* entry = &self->entries[requestId];
+    if (entry->kind != kind) {
+        return -1;
+    }
+
+    return entry->ownerIndex;
+}
+
+/// Frees the request id of a response that the owner has accepted
+void relayPendingRequestsAnswer(RelayPendingRequests* self, RelaySerializeRequestId requestId,
+                                RelayPendingRequestKind kind, size_t ownerIndex)
+{
+    if (relayPendingRequestsRemove(self, requestId, kind, ownerIndex)) {
+        self->stats.answeredCount++;
+    }
+}
+
+/// Counts a response that did not belong to a pending request, or that its owner did not accept
+void relayPendingRequestsIgnore(RelayPendingRequests* self)
+{
+    self->stats.unknownResponseCount++;
+}
+
+/// Frees the request id, unless it has already been handed out to someone else
+/// @return true if the request was removed
+bool relayPendingRequestsRemove(RelayPendingRequests* self, RelaySerializeRequestId requestId,
+                                RelayPendingRequestKind kind, size_t ownerIndex)
+{
+    RelayPendingRequest* entry = &self->entries[requestId];
+    if (entry->kind != kind || entry->ownerIndex != ownerIndex) {
+        return false;
+    }
+
+    entry->kind = RelayPendingRequestKindNone;
+    self->count--;
+
+    return true;
+}
+
+/// Frees the request id of a handshake that gave up without a response
+void relayPendingRequestsExpire(RelayPendingRequests* self, RelaySerializeRequestId requestId,
+                                RelayPendingRequestKind kind, size_t ownerIndex)
+{
+    if (relayPendingRequestsRemove(self, requestId, kind, ownerIndex)) {
+        self->stats.expiredCount++;
+    }
+}
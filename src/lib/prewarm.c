@@ -0,0 +1,126 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <inttypes.h>
+#include <relay-client/prewarm.h>
+
+/// Starts a connector for each target and sends all of their first connect requests right away, as one batch.
+/// The connectors are then kept alive by relayClientUpdate() like any other connector.
+/// @param now the same clock as is given to relayClientUpdate()
+/// @return the number of connectors that were started, they are fewer than targetCount if the client ran out
+int relayClientPrewarmConnects(RelayClient* self, const RelayConnectTarget* targets, size_t targetCount,
+                               MonotonicTimeMs now, RelayPrewarmedConnects* outPrewarmed)
+{
+    outPrewarmed->count = 0;
+
+    if (targetCount > RELAY_CLIENT_PREWARM_CAPACITY) {
+        CLOG_C_NOTICE(&self->log, "can only prewarm %d connects, skipping the last %zu", RELAY_CLIENT_PREWARM_CAPACITY,
+                      targetCount - RELAY_CLIENT_PREWARM_CAPACITY)
+        targetCount = RELAY_CLIENT_PREWARM_CAPACITY;
+    }
+
+    bool startedBatch = relaySocketBeginBatch(&self->socket);
+
+    for (size_t i = 0; i < targetCount; ++i) {
+        const RelayConnectTarget* target = &targets[i];
+        RelayConnector* connector = relayClientStartConnect(self, target->userId, target->applicationId,
+                                                            target->channelId);
+        if (connector == 0) {
+            break;
+        }
+
+        int updateErr = relayConnectorUpdate(connector, now);
+        if (updateErr < 0) {
+            CLOG_C_NOTICE(&self->log, "could not send prewarm connect request to %" PRIX64 ": %d", target->userId,
+                          updateErr)
+        }
+
+        outPrewarmed->targets[outPrewarmed->count] = *target;
+        outPrewarmed->connectors[outPrewarmed->count] = connector;
+        outPrewarmed->requestIds[outPrewarmed->count] = connector->requestId;
+        outPrewarmed->count++;
+    }
+
+    int flushErr = relaySocketEndBatch(&self->socket, startedBatch);
+    if (flushErr < 0) {
+        CLOG_C_NOTICE(&self->log, "could not flush prewarm connect requests: %d", flushErr)
+    }
+
+    return (int) outPrewarmed->count;
+}
+
+/// @return true if the connector at index has not given up and has not been reused for another connect since
+static bool relayPrewarmedConnectsIsOwned(const RelayPrewarmedConnects* self, size_t index)
+{
+    const RelayConnector* connector = self->connectors[index];
+    const RelayConnectTarget* target = &self->targets[index];
+
+    return connector->state != RelayConnectorStateIdle && connector->requestId == self->requestIds[index] &&
+           connector->connectToUserId == target->userId && connector->applicationId == target->applicationId &&
+           connector->channelId == target->channelId;
+}
+
+/// Stops the prewarmed connectors, except the one at keepIndex, that are still prewarmed
+static void relayPrewarmedConnectsStop(RelayClient* client, RelayPrewarmedConnects* self, size_t keepIndex)
+{
+    for (size_t i = 0; i < self->count; ++i) {
+        if (i != keepIndex && relayPrewarmedConnectsIsOwned(self, i)) {
+            relayClientStopConnect(client, self->connectors[i]);
+        }
+    }
+    self->count = 0;
+}
+
+/// @return the number of prewarmed connectors that the relay server has assigned a connection id to
+size_t relayPrewarmedConnectsReadyCount(const RelayPrewarmedConnects* self)
+{
+    size_t readyCount = 0;
+    for (size_t i = 0; i < self->count; ++i) {
+        if (relayPrewarmedConnectsIsOwned(self, i) && self->connectors[i]->state == RelayConnectorStateConnected) {
+            readyCount++;
+        }
+    }
+
+    return readyCount;
+}
+
+/// Hands out the connector for the target and stops all the others.
+/// The connector can be used at once, packets sent before the handshake is done are queued until it is.
+/// @return the connector, or zero if no connector was prewarmed for the target or it gave up. Nothing is released
+/// if the target is not found.
+RelayConnector* relayClientClaimPrewarmed(RelayClient* self, RelayPrewarmedConnects* prewarmed,
+                                          const RelayConnectTarget* target)
+{
+    size_t foundIndex = prewarmed->count;
+    for (size_t i = 0; i < prewarmed->count; ++i) {
+        const RelayConnectTarget* candidate = &prewarmed->targets[i];
+        if (candidate->userId == target->userId && candidate->applicationId == target->applicationId &&
+            candidate->channelId == target->channelId) {
+            foundIndex = i;
+            break;
+        }
+    }
+
+    if (foundIndex == prewarmed->count) {
+        CLOG_C_NOTICE(&self->log, "no prewarmed connect to %" PRIX64, target->userId)
+        return 0;
+    }
+
+    RelayConnector* claimed = prewarmed->connectors[foundIndex];
+    bool isOwned = relayPrewarmedConnectsIsOwned(prewarmed, foundIndex);
+    relayPrewarmedConnectsStop(self, prewarmed, foundIndex);
+
+    if (!isOwned) {
+        CLOG_C_NOTICE(&self->log, "prewarmed connect to %" PRIX64 " gave up", target->userId)
+        return 0;
+    }
+
+    return claimed;
+}
+
+/// Stops every prewarmed connector, for example when matchmaking was cancelled
+void relayClientReleasePrewarmed(RelayClient* self, RelayPrewarmedConnects* prewarmed)
+{
+    relayPrewarmedConnectsStop(self, prewarmed, prewarmed->count);
+}
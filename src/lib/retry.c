@@ -0,0 +1,88 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <clog/clog.h>
+#include <relay-client/retry.h>
+
+void relayRetrySetupDefaults(RelayRetrySetup* setup)
+{
+    setup->initialTimeoutMs = RELAY_RETRY_DEFAULT_INITIAL_TIMEOUT_MS;
+    setup->maxTimeoutMs = RELAY_RETRY_DEFAULT_MAX_TIMEOUT_MS;
+    setup->maxAttemptCount = RELAY_RETRY_DEFAULT_MAX_ATTEMPT_COUNT;
+    setup->jitterPercent = RELAY_RETRY_DEFAULT_JITTER_PERCENT;
+}
+
+static uint32_t relayRetryRandom(RelayRetry* self)
+{
+    // xorshift32
+    uint32_t x = self->randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    self->randomState = x;
+
+    return x;
+}
+
+/// @param seed should differ between clients, so that clients that start at the same time spread out their retries
+void relayRetryInit(RelayRetry* self, const RelayRetrySetup* setup, uint64_t seed)
+{
+    CLOG_ASSERT(setup->initialTimeoutMs > 0 && setup->maxTimeoutMs >= setup->initialTimeoutMs,
+                "illegal retry timeouts")
+    CLOG_ASSERT(setup->jitterPercent < 100, "jitter must be below 100 percent")
+
+    self->setup = *setup;
+
+    uint64_t mixed = seed * UINT64_C(0x9E3779B97F4A7C15);
+    self->randomState = (uint32_t) (mixed >> 32) ^ (uint32_t) mixed;
+    if (self->randomState == 0) {
+        self->randomState = 0x6d2b79f5;
+    }
+
+    relayRetryReset(self);
+}
+
+/// Starts over, the next update sends the first attempt
+void relayRetryReset(RelayRetry* self)
+{
+    self->attemptCount = 0;
+    self->timeoutMs = self->setup.initialTimeoutMs;
+    self->nextAttemptAt = 0;
+}
+
+static MonotonicTimeMs relayRetryJitteredTimeout(RelayRetry* self)
+{
+    MonotonicTimeMs span = self->timeoutMs * (MonotonicTimeMs) self->setup.jitterPercent / 100;
+    if (span == 0) {
+        return self->timeoutMs;
+    }
+
+    MonotonicTimeMs offset = (MonotonicTimeMs) (relayRetryRandom(self) % (uint32_t) (span * 2 + 1));
+
+    return self->timeoutMs - span + offset;
+}
+
+/// Tells the caller if it is time to send the request (again), or if it should give up
+RelayRetryAction relayRetryUpdate(RelayRetry* self, MonotonicTimeMs now)
+{
+    if (self->attemptCount > 0 && now < self->nextAttemptAt) {
+        return RelayRetryActionWait;
+    }
+
+    if (self->attemptCount >= self->setup.maxAttemptCount) {
+        return RelayRetryActionTimedOut;
+    }
+
+    if (self->attemptCount > 0) {
+        self->timeoutMs *= 2;
+        if (self->timeoutMs > self->setup.maxTimeoutMs) {
+            self->timeoutMs = self->setup.maxTimeoutMs;
+        }
+    }
+
+    self->attemptCount++;
+    self->nextAttemptAt = now + relayRetryJitteredTimeout(self);
+
+    return RelayRetryActionSend;
+}
@@ -0,0 +1,135 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <imprint/allocator.h>
+#include <relay-client/route.h>
+
+static size_t relayRoutesHome(const RelayRoutes* self, RelaySerializeConnectionId connectionId)
+{
+    // Fibonacci hashing, connection ids from the server can be sequential
+    uint64_t hash = (uint64_t) connectionId * UINT64_C(0x9E3779B97F4A7C15);
+    return (size_t) (hash >> 32) & self->mask;
+}
+
+/// @param maxRouteCount the maximum number of connection ids that can be routed at the same time
+void relayRoutesInit(RelayRoutes* self, struct ImprintAllocator* memory, size_t maxRouteCount)
+{
+    // at least twice the route count, so the load factor stays low
+    size_t capacity = 16;
+    while (capacity < maxRouteCount * 2) {
+        capacity *= 2;
+    }
+
+    self->entries = IMPRINT_ALLOC_TYPE_COUNT(memory, RelayRoute, capacity);
+    self->capacity = capacity;
+    self->mask = capacity - 1;
+    relayRoutesReset(self);
+}
+
+void relayRoutesReset(RelayRoutes* self)
+{
+    for (size_t i = 0; i < self->capacity; ++i) {
+        self->entries[i].connectionId = 0;
+        self->entries[i].kind = RelayRouteKindNone;
+    }
+    self->count = 0;
+}
+
+/// Adds or replaces the route for connectionId
+/// @return zero on success, negative if the table is full
+int relayRoutesInsert(RelayRoutes* self, RelaySerializeConnectionId connectionId, RelayRouteKind kind,
+                      size_t ownerIndex, size_t connectionIndex)
+{
+    if (connectionId == 0) {
+        return -2;
+    }
+
+    size_t index = relayRoutesHome(self, connectionId);
+    for (size_t probe = 0; probe < self->capacity; ++probe) {
+        RelayRoute* entry = &self->entries[index];
+        if (entry->connectionId == 0 || entry->connectionId == connectionId) {
+            if (entry->connectionId == 0) {
+                // keep the load factor below 3/4 so probe sequences stay short
+                if (self->count >= self->capacity - self->capacity / 4) {
+                    return -1;
+                }
+                self->count++;
+            }
+            entry->connectionId = connectionId;
+            entry->kind = kind;
+            entry->ownerIndex = (uint16_t) ownerIndex;
+            entry->connectionIndex = (uint16_t) connectionIndex;
+            return 0;
+        }
+        index = (index + 1) & self->mask;
+    }
+
+    return -1;
+}
+
+const RelayRoute* relayRoutesFind(const RelayRoutes* self, RelaySerializeConnectionId connectionId)
+{
+    if (connectionId == 0) {
+        return 0;
+    }
+
+    size_t index = relayRoutesHome(self, connectionId);
+    for (size_t probe = 0; probe < self->capacity; ++probe) {
+        const RelayRoute* entry = &self->entries[index];
+        if (entry->connectionId == connectionId) {
+            return entry;
+        }
+        if (entry->connectionId == 0) {
+            return 0;
+        }
+        index = (index + 1) & self->mask;
+    }
+
+    return 0;
+}
+
+/// Removes the route for connectionId using backward shift deletion, so no tombstones are needed
+/// @return zero if removed, negative if there was no such route
+int relayRoutesRemove(RelayRoutes* self, RelaySerializeConnectionId connectionId)
+{
+    if (connectionId == 0) {
+        return -1;
+    }
+
+    size_t index = relayRoutesHome(self, connectionId);
+    size_t probe = 0;
+    for (; probe < self->capacity; ++probe) {
+        RelaySerializeConnectionId existingId = self->entries[index].connectionId;
+        if (existingId == connectionId) {
+            break;
+        }
+        if (existingId == 0) {
+            return -1;
+        }
+        index = (index + 1) & self->mask;
+    }
+
+    if (probe == self->capacity) {
+        return -1;
+    }
+
+    size_t hole = index;
+    size_t next = (hole + 1) & self->mask;
+    while (self->entries[next].connectionId != 0) {
+        size_t home = relayRoutesHome(self, self->entries[next].connectionId);
+        size_t distanceFromHomeToNext = (next - home) & self->mask;
+        size_t distanceFromHoleToNext = (next - hole) & self->mask;
+        if (distanceFromHomeToNext >= distanceFromHoleToNext) {
+            self->entries[hole] = self->entries[next];
+            hole = next;
+        }
+        next = (next + 1) & self->mask;
+    }
+
+    self->entries[hole].connectionId = 0;
+    self->entries[hole].kind = RelayRouteKindNone;
+    self->count--;
+
+    return 0;
+}
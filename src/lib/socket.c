@@ -4,22 +4,509 @@
  *--------------------------------------------------------------------------------------------------------*/
 #include <datagram-transport/types.h>
 #include <flood/out_stream.h>
+#include <imprint/allocator.h>
 #include <relay-client/socket.h>
 
+void relaySocketInit(RelaySocket* self, DatagramTransport transport, struct ImprintAllocator* memory, Clog log)
+{
+    self->transport = transport;
+    self->hooks.self = 0;
+    self->hooks.receiveMany = 0;
+    self->hooks.sendMany = 0;
+    self->hooks.pollFd = 0;
+    self->useOutQueue = false;
+    self->useCoalescing = false;
+    self->openDatagramIndex = RELAY_SOCKET_NO_OPEN_DATAGRAM;
+    self->outQueue.octets = 0;
+    self->outQueue.datagrams = 0;
+    self->outQueue.count = 0;
+    self->outQueue.capacity = 0;
+    self->stats.datagramsSent = 0;
+    self->stats.octetsSent = 0;
+    self->stats.sendErrorCount = 0;
+    self->stats.transportSendCalls = 0;
+    self->stats.flushCount = 0;
+    self->stats.coalescedPacketCount = 0;
+    self->reservation.isActive = false;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    tc_mem_clear_type(&self->sendLatency);
+    self->oldestQueuedAt = 0;
+#endif
+    self->memory = memory;
+    self->log = log;
+}
 
-int relaySocketSendPacket(DatagramTransport transportToRelayServer, RelaySerializeUserSessionId userSessionId,
-                          RelaySerializeConnectionId connectionId, const uint8_t* octets, size_t octetCount)
+void relaySocketSetOutQueueEnabled(RelaySocket* self, bool enabled)
 {
-    uint8_t buf[DATAGRAM_TRANSPORT_MAX_SIZE];
-    FldOutStream outStream;
-    fldOutStreamInit(&outStream, buf, DATAGRAM_TRANSPORT_MAX_SIZE);
+    if (!enabled) {
+        relaySocketFlush(self);
+        self->useOutQueue = false;
+        return;
+    }
+
+    RelaySocketOutQueue* queue = &self->outQueue;
+    if (queue->octets == 0) {
+        queue->capacity = RELAY_SOCKET_OUT_QUEUE_CAPACITY;
+        queue->octets = IMPRINT_ALLOC(self->memory, queue->capacity * DATAGRAM_TRANSPORT_MAX_SIZE,
+                                      "relay socket out queue");
+        queue->datagrams = IMPRINT_ALLOC_TYPE_COUNT(self->memory, RelayDatagram, queue->capacity);
+        for (size_t i = 0; i < queue->capacity; ++i) {
+            queue->datagrams[i].octets = queue->octets + i * DATAGRAM_TRANSPORT_MAX_SIZE;
+            queue->datagrams[i].octetCount = 0;
+        }
+        queue->count = 0;
+    }
+
+    self->useOutQueue = true;
+}
+
+/// Packets that are sent while coalescing is enabled are appended to the last queued datagram if they fit, so
+/// several small packets, for one or several connections, share one datagram. Coalescing needs the out queue,
+/// so it is enabled as well. Disabling coalescing keeps the out queue enabled.
+void relaySocketSetCoalescingEnabled(RelaySocket* self, bool enabled)
+{
+    if (enabled) {
+        relaySocketSetOutQueueEnabled(self, true);
+    }
+
+    self->useCoalescing = enabled;
+    self->openDatagramIndex = RELAY_SOCKET_NO_OPEN_DATAGRAM;
+}
+
+static int relaySocketSendNow(RelaySocket* self, const uint8_t* octets, size_t octetCount)
+{
+    self->stats.transportSendCalls++;
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    MonotonicTimeMs startedAt = monotonicTimeMsNow();
+    int result = datagramTransportSend(&self->transport, octets, octetCount);
+    relayLatencyHistogramAdd(&self->sendLatency, (uint32_t) (monotonicTimeMsNow() - startedAt));
+#else
+    int result = datagramTransportSend(&self->transport, octets, octetCount);
+#endif
+    if (result < 0) {
+        self->stats.sendErrorCount++;
+        return result;
+    }
+
+    self->stats.datagramsSent++;
+    self->stats.octetsSent += octetCount;
+
+    return result;
+}
+
+/// Returns a buffer of DATAGRAM_TRANSPORT_MAX_SIZE octets at the end of the out queue, flushing if needed
+static RelayDatagram* relaySocketQueueSlot(RelaySocket* self)
+{
+    RelaySocketOutQueue* queue = &self->outQueue;
+    if (queue->count == queue->capacity) {
+        relaySocketFlush(self);
+    }
+
+    // nothing is appended to the previous datagram once another one is queued after it
+    self->openDatagramIndex = RELAY_SOCKET_NO_OPEN_DATAGRAM;
+
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    if (queue->count == 0) {
+        self->oldestQueuedAt = monotonicTimeMsNow();
+    }
+#endif
+
+    return &queue->datagrams[queue->count];
+}
+
+int relaySocketSendDatagram(RelaySocket* self, const uint8_t* octets, size_t octetCount)
+{
+    if (!self->useOutQueue) {
+        return relaySocketSendNow(self, octets, octetCount);
+    }
+
+    if (octetCount > DATAGRAM_TRANSPORT_MAX_SIZE) {
+        CLOG_C_SOFT_ERROR(&self->log, "datagram is too big for the out queue %zu", octetCount)
+        return -2;
+    }
+
+    RelayDatagram* datagram = relaySocketQueueSlot(self);
+    tc_memcpy_octets(datagram->octets, octets, octetCount);
+    datagram->octetCount = octetCount;
+    self->outQueue.count++;
+
+    return 0;
+}
+
+/// Serializes the relay header for a connection once, so that sending a packet only has to copy it and fill in
+/// the payload octet count.
+/// @return negative if the header could not be serialized. RELAY_PACKET_HEADER_ERR_NOT_CACHED if the payload
+/// octet count could not be located in it, the header still works but is serialized again for every packet.
+int relayPacketHeaderInit(RelayPacketHeader* self, RelaySerializeUserSessionId userSessionId,
+                          RelaySerializeConnectionId connectionId)
+{
+    self->userSessionId = userSessionId;
+    self->connectionId = connectionId;
+    self->octetCountOffset = RELAY_PACKET_HEADER_NO_OCTET_COUNT_OFFSET;
 
     RelaySerializeServerPacketFromClientToServer packetHeader;
     packetHeader.connectionId = connectionId;
-    packetHeader.packetOctetCount = (uint16_t) octetCount;
+    packetHeader.packetOctetCount = 0;
+
+    FldOutStream outStream;
+    fldOutStreamInit(&outStream, self->octets, RELAY_PACKET_HEADER_MAX_OCTET_COUNT);
+    int headerErr = relaySerializeClientOutPacketToServerHeader(&outStream, userSessionId, packetHeader);
+    if (headerErr < 0) {
+        return headerErr;
+    }
+    self->octetCount = (uint8_t) outStream.pos;
 
+    // the payload octet count is the only field that changes when it is serialized with another value
+    uint8_t withMaxOctetCount[RELAY_PACKET_HEADER_MAX_OCTET_COUNT];
+    packetHeader.packetOctetCount = UINT16_MAX;
+    fldOutStreamInit(&outStream, withMaxOctetCount, RELAY_PACKET_HEADER_MAX_OCTET_COUNT);
     relaySerializeClientOutPacketToServerHeader(&outStream, userSessionId, packetHeader);
-    fldOutStreamWriteOctets(&outStream, octets, octetCount);
 
-    return transportToRelayServer.send(transportToRelayServer.self, outStream.octets, outStream.pos);
+    size_t octetCountOffset = 0;
+    while (octetCountOffset < self->octetCount &&
+           withMaxOctetCount[octetCountOffset] == self->octets[octetCountOffset]) {
+        octetCountOffset++;
+    }
+
+    if (outStream.pos != self->octetCount || octetCountOffset + sizeof(uint16_t) > self->octetCount) {
+        CLOG_WARN("could not find the packet octet count in the relay header, serializing it for every packet")
+        return RELAY_PACKET_HEADER_ERR_NOT_CACHED;
+    }
+
+    self->octetCountOffset = (uint8_t) octetCountOffset;
+
+    return 0;
+}
+
+static int relayPacketHeaderSetOctetCount(const RelayPacketHeader* self, uint8_t* datagram,
+                                          size_t payloadOctetCount)
+{
+    FldOutStream outStream;
+    if (self->octetCountOffset != RELAY_PACKET_HEADER_NO_OCTET_COUNT_OFFSET) {
+        fldOutStreamInit(&outStream, datagram + self->octetCountOffset, sizeof(uint16_t));
+        return fldOutStreamWriteUInt16(&outStream, (uint16_t) payloadOctetCount);
+    }
+
+    RelaySerializeServerPacketFromClientToServer packetHeader;
+    packetHeader.connectionId = self->connectionId;
+    packetHeader.packetOctetCount = (uint16_t) payloadOctetCount;
+
+    fldOutStreamInit(&outStream, datagram, self->octetCount);
+    int err = relaySerializeClientOutPacketToServerHeader(&outStream, self->userSessionId, packetHeader);
+    if (err < 0) {
+        return err;
+    }
+
+    // the payload has already been placed after octetCount octets
+    return outStream.pos == self->octetCount ? 0 : -3;
+}
+
+/// Copies the cached header to the start of datagram with the payload octet count filled in
+static int relayPacketHeaderWrite(const RelayPacketHeader* self, uint8_t* datagram, size_t payloadOctetCount)
+{
+    if (self->octetCountOffset != RELAY_PACKET_HEADER_NO_OCTET_COUNT_OFFSET) {
+        tc_memcpy_octets(datagram, self->octets, self->octetCount);
+    }
+
+    return relayPacketHeaderSetOctetCount(self, datagram, payloadOctetCount);
+}
+
+/// Writes the relay header into the outgoing datagram and returns where the payload should be written.
+/// Only one packet can be reserved at a time and it must be committed before anything else is sent on the socket.
+/// @param header must stay valid until the packet is committed
+/// @param outMaxOctetCount the maximum payload octet count that can be written
+/// @return pointer to the payload or NULL on error
+uint8_t* relaySocketReservePacketWithHeader(RelaySocket* self, const RelayPacketHeader* header,
+                                            size_t* outMaxOctetCount)
+{
+    RelaySocketReservation* reservation = &self->reservation;
+    if (reservation->isActive) {
+        CLOG_C_ERROR(&self->log, "a packet is already reserved, it must be committed first")
+        // return 0;
+    }
+
+    uint8_t* datagram;
+    if (self->useOutQueue) {
+        datagram = relaySocketQueueSlot(self)->octets;
+    } else {
+        datagram = self->sendBuf;
+    }
+
+    // the octet count is filled in on commit
+    tc_memcpy_octets(datagram, header->octets, header->octetCount);
+
+    reservation->isActive = true;
+    reservation->isInOutQueue = self->useOutQueue;
+    reservation->datagram = datagram;
+    reservation->header = header;
+
+    *outMaxOctetCount = DATAGRAM_TRANSPORT_MAX_SIZE - (size_t) header->octetCount;
+
+    return datagram + header->octetCount;
+}
+
+/// Same as relaySocketReservePacketWithHeader(), but serializes the header for the connection first
+uint8_t* relaySocketReservePacket(RelaySocket* self, RelaySerializeUserSessionId userSessionId,
+                                  RelaySerializeConnectionId connectionId, size_t* outMaxOctetCount)
+{
+    int headerErr = relayPacketHeaderInit(&self->reservationHeader, userSessionId, connectionId);
+    if (headerErr < 0 && headerErr != RELAY_PACKET_HEADER_ERR_NOT_CACHED) {
+        *outMaxOctetCount = 0;
+        return 0;
+    }
+
+    return relaySocketReservePacketWithHeader(self, &self->reservationHeader, outMaxOctetCount);
+}
+
+/// Completes a packet from relaySocketReservePacket() with the number of payload octets that were written
+int relaySocketCommitPacket(RelaySocket* self, size_t octetCount)
+{
+    RelaySocketReservation* reservation = &self->reservation;
+    if (!reservation->isActive) {
+        CLOG_C_SOFT_ERROR(&self->log, "commit without a reserved packet")
+        return -1;
+    }
+    reservation->isActive = false;
+
+    const RelayPacketHeader* header = reservation->header;
+    if (octetCount > DATAGRAM_TRANSPORT_MAX_SIZE - (size_t) header->octetCount) {
+        CLOG_C_SOFT_ERROR(&self->log, "packet is too big to send to relay %zu", octetCount)
+        return -2;
+    }
+
+    int headerErr = relayPacketHeaderSetOctetCount(header, reservation->datagram, octetCount);
+    if (headerErr < 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "could not write relay header %d", headerErr)
+        return headerErr;
+    }
+
+    size_t datagramOctetCount = header->octetCount + octetCount;
+
+    if (reservation->isInOutQueue) {
+        RelayDatagram* datagram = &self->outQueue.datagrams[self->outQueue.count];
+        datagram->octetCount = datagramOctetCount;
+        if (self->useCoalescing) {
+            self->openDatagramIndex = self->outQueue.count;
+        }
+        self->outQueue.count++;
+        return 0;
+    }
+
+    return relaySocketSendNow(self, reservation->datagram, datagramOctetCount);
+}
+
+/// Sends a packet using the cached header of the connection
+int relaySocketSendPacketWithHeader(RelaySocket* self, const RelayPacketHeader* header, const uint8_t* octets,
+                                    size_t octetCount)
+{
+    if (octetCount > DATAGRAM_TRANSPORT_MAX_SIZE - (size_t) header->octetCount) {
+        CLOG_C_SOFT_ERROR(&self->log, "packet is too big to send to relay %zu", octetCount)
+        return -2;
+    }
+
+    size_t packetOctetCount = header->octetCount + octetCount;
+
+    if (self->openDatagramIndex != RELAY_SOCKET_NO_OPEN_DATAGRAM) {
+        RelayDatagram* open = &self->outQueue.datagrams[self->openDatagramIndex];
+        if (open->octetCount + packetOctetCount <= DATAGRAM_TRANSPORT_MAX_SIZE) {
+            int headerErr = relayPacketHeaderWrite(header, open->octets + open->octetCount, octetCount);
+            if (headerErr < 0) {
+                return headerErr;
+            }
+            tc_memcpy_octets(open->octets + open->octetCount + header->octetCount, octets, octetCount);
+            open->octetCount += packetOctetCount;
+            self->stats.coalescedPacketCount++;
+            return 0;
+        }
+    }
+
+    uint8_t* datagram;
+    if (self->useOutQueue) {
+        datagram = relaySocketQueueSlot(self)->octets;
+    } else {
+        datagram = self->sendBuf;
+    }
+
+    int headerErr = relayPacketHeaderWrite(header, datagram, octetCount);
+    if (headerErr < 0) {
+        return headerErr;
+    }
+    tc_memcpy_octets(datagram + header->octetCount, octets, octetCount);
+
+    if (self->useOutQueue) {
+        self->outQueue.datagrams[self->outQueue.count].octetCount = packetOctetCount;
+        if (self->useCoalescing) {
+            self->openDatagramIndex = self->outQueue.count;
+        }
+        self->outQueue.count++;
+        return 0;
+    }
+
+    return relaySocketSendNow(self, datagram, packetOctetCount);
+}
+
+int relaySocketSendPacket(RelaySocket* self, RelaySerializeUserSessionId userSessionId,
+                          RelaySerializeConnectionId connectionId, const uint8_t* octets, size_t octetCount)
+{
+    RelayPacketHeader header;
+    int headerErr = relayPacketHeaderInit(&header, userSessionId, connectionId);
+    if (headerErr < 0 && headerErr != RELAY_PACKET_HEADER_ERR_NOT_CACHED) {
+        return -1;
+    }
+
+    return relaySocketSendPacketWithHeader(self, &header, octets, octetCount);
+}
+
+/// Starts collecting datagrams so they can be sent with a single sendMany call. Only has an effect when the socket
+/// is not in queued mode and there is a sendMany hook.
+/// @return true if relaySocketEndBatch() has to flush
+bool relaySocketBeginBatch(RelaySocket* self)
+{
+    if (self->useOutQueue || self->hooks.sendMany == 0) {
+        return false;
+    }
+
+    relaySocketSetOutQueueEnabled(self, true);
+
+    return true;
+}
+
+int relaySocketEndBatch(RelaySocket* self, bool startedBatch)
+{
+    if (!startedBatch) {
+        return 0;
+    }
+
+    int result = relaySocketFlush(self);
+    self->useOutQueue = false;
+
+    return result;
+}
+
+/// Sends the same payload to several connections. The payload is only copied for the first datagram, the others
+/// are copies of the previous datagram with the cached header of their connection written over the start.
+/// The datagrams are collected in the out queue and sent as one batch, unless the socket has neither the out queue
+/// nor a sendMany hook, then a single buffer is patched and sent for each connection.
+int relaySocketSendPacketToMany(RelaySocket* self, const RelayPacketHeader* const* headers, size_t connectionCount,
+                                const uint8_t* octets, size_t octetCount)
+{
+    if (connectionCount == 0) {
+        return 0;
+    }
+
+    bool startedBatch = relaySocketBeginBatch(self);
+
+    size_t maxOctetCount;
+    uint8_t* payload = relaySocketReservePacketWithHeader(self, headers[0], &maxOctetCount);
+
+    if (octetCount > maxOctetCount) {
+        CLOG_C_SOFT_ERROR(&self->log, "packet is too big to send to relay %zu", octetCount)
+        self->reservation.isActive = false;
+        relaySocketEndBatch(self, startedBatch);
+        return -2;
+    }
+
+    tc_memcpy_octets(payload, octets, octetCount);
+
+    const uint8_t* previousDatagram = self->reservation.datagram;
+    size_t previousOctetCount = headers[0]->octetCount + octetCount;
+
+    int result = relaySocketCommitPacket(self, octetCount);
+    for (size_t i = 1; i < connectionCount && result >= 0; ++i) {
+        const RelayPacketHeader* header = headers[i];
+        size_t datagramOctetCount = header->octetCount + octetCount;
+        if (datagramOctetCount > DATAGRAM_TRANSPORT_MAX_SIZE) {
+            CLOG_C_SOFT_ERROR(&self->log, "packet is too big to send to relay %zu", octetCount)
+            result = -2;
+            break;
+        }
+
+        if (!self->useOutQueue) {
+            // the payload is already in place, headers for the same session all have the same size
+            CLOG_ASSERT(header->octetCount == headers[0]->octetCount, "relay headers differ in size")
+            result = relayPacketHeaderWrite(header, self->sendBuf, octetCount);
+            if (result >= 0) {
+                result = relaySocketSendNow(self, self->sendBuf, datagramOctetCount);
+            }
+            continue;
+        }
+
+        RelayDatagram* datagram = relaySocketQueueSlot(self);
+        size_t previousHeaderOctetCount = previousOctetCount - octetCount;
+        tc_memcpy_octets(datagram->octets + header->octetCount, previousDatagram + previousHeaderOctetCount,
+                         octetCount);
+        result = relayPacketHeaderWrite(header, datagram->octets, octetCount);
+        if (result < 0) {
+            break;
+        }
+        datagram->octetCount = datagramOctetCount;
+        self->outQueue.count++;
+
+        previousDatagram = datagram->octets;
+        previousOctetCount = datagramOctetCount;
+    }
+
+    int flushResult = relaySocketEndBatch(self, startedBatch);
+    if (flushResult < 0) {
+        return flushResult;
+    }
+
+    return result;
+}
+
+/// Sends all queued datagrams, using the sendMany hook if it is available
+int relaySocketFlush(RelaySocket* self)
+{
+    RelaySocketOutQueue* queue = &self->outQueue;
+    if (queue->count == 0) {
+        return 0;
+    }
+
+    CLOG_ASSERT(!self->reservation.isActive, "can not flush while a packet is reserved")
+
+    self->stats.flushCount++;
+
+    int result = 0;
+    size_t sentCount = 0;
+    if (self->hooks.sendMany != 0) {
+        while (sentCount < queue->count) {
+            self->stats.transportSendCalls++;
+            int batchCount = self->hooks.sendMany(self->hooks.self, &queue->datagrams[sentCount],
+                                                  queue->count - sentCount);
+            if (batchCount <= 0) {
+                result = batchCount < 0 ? batchCount : -1;
+                break;
+            }
+            sentCount += (size_t) batchCount;
+        }
+    } else {
+        for (; sentCount < queue->count; ++sentCount) {
+            const RelayDatagram* datagram = &queue->datagrams[sentCount];
+            self->stats.transportSendCalls++;
+            int sendErr = datagramTransportSend(&self->transport, datagram->octets, datagram->octetCount);
+            if (sendErr < 0) {
+                result = sendErr;
+                break;
+            }
+        }
+    }
+
+    if (result < 0) {
+        CLOG_C_SOFT_ERROR(&self->log, "could not flush out queue, dropping %zu datagrams", queue->count - sentCount)
+        self->stats.sendErrorCount++;
+    }
+
+    for (size_t i = 0; i < sentCount; ++i) {
+        self->stats.octetsSent += queue->datagrams[i].octetCount;
+    }
+    self->stats.datagramsSent += sentCount;
+    queue->count = 0;
+    self->openDatagramIndex = RELAY_SOCKET_NO_OPEN_DATAGRAM;
+
+#if defined RELAY_CLIENT_LATENCY_TRACING
+    // the oldest datagram has waited the longest, that is the latency the flush added
+    relayLatencyHistogramAdd(&self->sendLatency, (uint32_t) (monotonicTimeMsNow() - self->oldestQueuedAt));
+#endif
+
+    return result;
 }
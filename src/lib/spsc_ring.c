@@ -0,0 +1,70 @@
+/*----------------------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved. https://github.com/piot/relay-client-c
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------------------*/
+#include <clog/clog.h>
+#include <imprint/allocator.h>
+#include <relay-client/spsc_ring.h>
+
+/// @param capacity must be a power of two
+void relaySpscRingInit(RelaySpscRing* self, struct ImprintAllocator* memory, size_t itemOctetCount, size_t capacity)
+{
+    CLOG_ASSERT(capacity != 0 && (capacity & (capacity - 1)) == 0, "ring capacity must be a power of two")
+    self->items = IMPRINT_ALLOC(memory, itemOctetCount * capacity, "spsc ring items");
+    self->itemOctetCount = itemOctetCount;
+    self->capacity = capacity;
+    relaySpscRingReset(self);
+}
+
+/// Only allowed when neither the producer nor the consumer thread is using the ring
+void relaySpscRingReset(RelaySpscRing* self)
+{
+    __atomic_store_n(&self->head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&self->tail, 0, __ATOMIC_RELAXED);
+}
+
+/// @return number of items the producer can write before committing
+size_t relaySpscRingProducerAvailable(const RelaySpscRing* self)
+{
+    size_t head = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+    size_t tail = __atomic_load_n(&self->tail, __ATOMIC_RELAXED);
+
+    return self->capacity - (tail - head);
+}
+
+void* relaySpscRingProducerItem(RelaySpscRing* self, size_t index)
+{
+    size_t tail = __atomic_load_n(&self->tail, __ATOMIC_RELAXED);
+
+    return self->items + ((tail + index) & (self->capacity - 1)) * self->itemOctetCount;
+}
+
+/// Publishes the first count written items to the consumer
+void relaySpscRingProducerCommit(RelaySpscRing* self, size_t count)
+{
+    size_t tail = __atomic_load_n(&self->tail, __ATOMIC_RELAXED);
+    __atomic_store_n(&self->tail, tail + count, __ATOMIC_RELEASE);
+}
+
+/// @return number of items that are ready to be read
+size_t relaySpscRingConsumerAvailable(const RelaySpscRing* self)
+{
+    size_t tail = __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE);
+    size_t head = __atomic_load_n(&self->head, __ATOMIC_RELAXED);
+
+    return tail - head;
+}
+
+void* relaySpscRingConsumerItem(RelaySpscRing* self, size_t index)
+{
+    size_t head = __atomic_load_n(&self->head, __ATOMIC_RELAXED);
+
+    return self->items + ((head + index) & (self->capacity - 1)) * self->itemOctetCount;
+}
+
+/// Hands the first count read items back to the producer
+void relaySpscRingConsumerRelease(RelaySpscRing* self, size_t count)
+{
+    size_t head = __atomic_load_n(&self->head, __ATOMIC_RELAXED);
+    __atomic_store_n(&self->head, head + count, __ATOMIC_RELEASE);
+}